@@ -0,0 +1,324 @@
+#pragma once
+#include <iostream>
+#include <array>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "IntcodeComputer.cpp"
+
+// One run of a batch: memory cells patched before the run and its inputs
+struct BatchRun
+{
+  vector<pair<size_t, IntCode>> patches {};
+  vector<IntCode> inputs {};
+};
+
+struct BatchResult
+{
+  vector<IntCode> outputs {};
+  vector<IntCode> watched {}; // values of the watched cells once the run stopped
+  bool terminated = false;
+};
+
+size_t lockstepScalarFallbacks = 0;
+
+// Runs up to Lanes instances of one program in lockstep: they share the
+// instruction pointer and relative base, memory is laid out as a struct of
+// arrays (one row of Lanes values per address) so arithmetic and comparisons
+// are plain loops over a row the compiler turns into SIMD code. Rows are paged
+// like IntcodeMemory, far addresses only cost the page they touch. A lane whose
+// control flow leaves the leading lane is handed to a scalar IntcodeVM.
+template<size_t Lanes>
+class IntcodeLockstep
+{
+public:
+  using LaneValues = array<IntCode, Lanes>;
+
+  IntcodeLockstep(const vector<IntCode> &program, const BatchRun *laneRuns, size_t laneCount, const vector<size_t> &watchedCells)
+    : runs(laneRuns), watchedCells(watchedCells) {
+    for(size_t address = 0; address < program.size(); address++) {
+      writableRow(address).fill(program[address]);
+    }
+    for(size_t lane = 0; lane < Lanes; lane++) {
+      active[lane] = lane < laneCount;
+      if(active[lane]) {
+        for(const auto &[address, value] : runs[lane].patches) {
+          writableRow(address)[lane] = value;
+        }
+      }
+    }
+    updateLeader();
+  }
+
+  vector<BatchResult> run() {
+    while(lead < Lanes && stepLanes());
+    return results;
+  }
+
+  // Results indexed by lane, only meaningful once run() returned
+  vector<BatchResult> results = vector<BatchResult>(Lanes);
+
+private:
+  const BatchRun *runs;
+  const vector<size_t> &watchedCells;
+  using LanePage = array<LaneValues, memoryPageSize>;
+
+  vector<unique_ptr<LanePage>> pages {};
+  unordered_map<size_t, unique_ptr<LanePage>> farPages {};
+  size_t highWater = 0;
+  array<bool, Lanes> active {};
+  array<size_t, Lanes> inputIndex {};
+  size_t instructionPointer = 0;
+  IntCode relativeBase = 0;
+
+  // First lane still in lockstep, the one the others follow
+  size_t lead = 0;
+
+  void updateLeader() {
+    lead = find(active.cbegin(), active.cend(), true) - active.cbegin();
+  }
+
+  // Reads never allocate, rows outside of the allocated pages are zero
+  const LaneValues &row(size_t address) const {
+    static const LaneValues zeroRow {};
+    const size_t index = address >> memoryPageBits;
+    const unique_ptr<LanePage> *page = nullptr;
+    if(index < pages.size()) {
+      page = &pages[index];
+    } else if(const auto far = farPages.find(index); far != farPages.cend()) {
+      page = &far->second;
+    }
+    return page && *page ? (**page)[address & memoryPageMask] : zeroRow;
+  }
+
+  LaneValues &writableRow(size_t address) {
+    if(address >= highWater) {
+      highWater = address + 1;
+    }
+    const size_t index = address >> memoryPageBits;
+    unique_ptr<LanePage> *page;
+    if(index < maxDenseMemoryPages) {
+      if(index >= pages.size()) {
+        pages.resize(index + 1);
+      }
+      page = &pages[index];
+    } else {
+      page = &farPages[index];
+    }
+    if(!*page) {
+      *page = make_unique<LanePage>();
+    }
+    return (**page)[address & memoryPageMask];
+  }
+
+  bool uniform(const LaneValues &values) const {
+    const IntCode reference = values[lead];
+    for(size_t lane = 0; lane < Lanes; lane++) {
+      if(active[lane] && values[lane] != reference) return false;
+    }
+    return true;
+  }
+
+  LaneValues paramAddresses(size_t paramNumber, int mode) {
+    LaneValues addresses;
+    if(mode == ImmediateMode) {
+      addresses.fill(instructionPointer + paramNumber);
+      return addresses;
+    }
+    addresses = row(instructionPointer + paramNumber);
+    if(mode == RelativeMode) {
+      for(size_t lane = 0; lane < Lanes; lane++) addresses[lane] += relativeBase;
+    }
+    for(size_t lane = 0; lane < Lanes; lane++) {
+      if(active[lane] && addresses[lane] < 0) {
+        cerr << "Illegal program memory access: negative address\n";
+        throw;
+      }
+    }
+    return addresses;
+  }
+
+  LaneValues load(const LaneValues &addresses) {
+    if(uniform(addresses)) {
+      return row(addresses[lead]);
+    }
+    LaneValues values {};
+    for(size_t lane = 0; lane < Lanes; lane++) {
+      if(active[lane]) values[lane] = row(addresses[lane])[lane];
+    }
+    return values;
+  }
+
+  LaneValues param(size_t paramNumber, int mode) {
+    return load(paramAddresses(paramNumber, mode));
+  }
+
+  void store(const LaneValues &addresses, const LaneValues &values) {
+    if(uniform(addresses)) {
+      writableRow(addresses[lead]) = values;
+      return;
+    }
+    for(size_t lane = 0; lane < Lanes; lane++) {
+      if(active[lane]) writableRow(addresses[lane])[lane] = values[lane];
+    }
+  }
+
+  // Hands a lane over to a scalar VM, which runs it until it stops. Its memory
+  // is paged like any VM memory and the relative base keeps its full width.
+  void dropToScalar(size_t lane, size_t laneInstructionPointer, IntCode laneRelativeBase) {
+    IntcodeMemory laneMemory;
+    const auto copyPage = [&](size_t index, const LanePage &page) {
+      for(size_t offset = 0; offset < memoryPageSize; offset++) {
+        if(page[offset][lane] != 0) laneMemory.write((index << memoryPageBits) + offset, page[offset][lane]);
+      }
+    };
+    for(size_t index = 0; index < pages.size(); index++) {
+      if(pages[index]) copyPage(index, *pages[index]);
+    }
+    for(const auto &[index, page] : farPages) {
+      copyPage(index, *page);
+    }
+    if(highWater > 0) {
+      laneMemory.write(highWater - 1, row(highWater - 1)[lane]);
+    }
+    queue<IntCode> laneInputs;
+    for(size_t i = inputIndex[lane]; i < runs[lane].inputs.size(); i++) {
+      laneInputs.push(runs[lane].inputs[i]);
+    }
+
+    IntcodeVM vm(move(laneMemory), laneInstructionPointer, laneRelativeBase, move(laneInputs), false);
+    vm.outputs = move(results[lane].outputs);
+    vm.resume();
+    results[lane].outputs = move(vm.outputs);
+    results[lane].terminated = vm.terminated;
+    for(const size_t address : watchedCells) {
+      results[lane].watched.push_back(vm.read(address));
+    }
+    active[lane] = false;
+    updateLeader();
+    lockstepScalarFallbacks++;
+  }
+
+  void finishLanes() {
+    for(size_t lane = 0; lane < Lanes; lane++) {
+      if(!active[lane]) continue;
+      results[lane].terminated = true;
+      for(const size_t address : watchedCells) {
+        results[lane].watched.push_back(row(address)[lane]);
+      }
+      active[lane] = false;
+    }
+    updateLeader();
+  }
+
+  // Executes one instruction on every lane still in lockstep, false once they all stopped
+  bool stepLanes() {
+    const LaneValues &instructions = row(instructionPointer);
+    const IntCode leadInstruction = instructions[lead];
+    for(size_t lane = 0; lane < Lanes; lane++) {
+      if(active[lane] && instructions[lane] != leadInstruction) {
+        dropToScalar(lane, instructionPointer, relativeBase);
+      }
+    }
+
+    const DecodedInstruction decoded = decodeInstruction(leadInstruction);
+    const int code = decoded / 27;
+    const int mode1 = decoded % 3;
+    const int mode2 = decoded / 3 % 3;
+    const int mode3 = decoded / 9 % 3;
+
+    if(decoded == haltInstruction) {
+      finishLanes();
+      return false;
+    }
+    if(code == 1 || code == 2) { // + & *
+      const LaneValues op1 = param(1, mode1);
+      const LaneValues op2 = param(2, mode2);
+      LaneValues result;
+      if(code == 1) {
+        for(size_t lane = 0; lane < Lanes; lane++) result[lane] = op1[lane] + op2[lane];
+      } else {
+        for(size_t lane = 0; lane < Lanes; lane++) result[lane] = op1[lane] * op2[lane];
+      }
+      store(paramAddresses(3, mode3), result);
+      instructionPointer += 4;
+    }
+    else if(code == 3) { // input, lanes running out of inputs pause in a scalar VM
+      for(size_t lane = 0; lane < Lanes; lane++) {
+        if(active[lane] && inputIndex[lane] >= runs[lane].inputs.size()) {
+          dropToScalar(lane, instructionPointer, relativeBase);
+        }
+      }
+      if(lead == Lanes) return false;
+      LaneValues input {};
+      for(size_t lane = 0; lane < Lanes; lane++) {
+        if(active[lane]) input[lane] = runs[lane].inputs[inputIndex[lane]++];
+      }
+      store(paramAddresses(1, mode1), input);
+      instructionPointer += 2;
+    }
+    else if(code == 4) { // output
+      const LaneValues value = param(1, mode1);
+      for(size_t lane = 0; lane < Lanes; lane++) {
+        if(active[lane]) results[lane].outputs.push_back(value[lane]);
+      }
+      instructionPointer += 2;
+    }
+    else if(code == 5 || code == 6) { // jump if true & jump if false, lanes taking the other branch diverge
+      const LaneValues op1 = param(1, mode1);
+      const auto jumps = [&](size_t lane) { return (code == 5) == (op1[lane] != 0); };
+      bool anyJump = false;
+      for(size_t lane = 0; lane < Lanes; lane++) anyJump |= active[lane] && jumps(lane);
+      const LaneValues op2 = anyJump ? param(2, mode2) : LaneValues {};
+      const bool leaderJumps = jumps(lead);
+      for(size_t lane = 0; lane < Lanes; lane++) {
+        if(!active[lane]) continue;
+        if(jumps(lane) != leaderJumps || (leaderJumps && op2[lane] != op2[lead])) {
+          dropToScalar(lane, jumps(lane) ? op2[lane] : instructionPointer + 3, relativeBase);
+        }
+      }
+      instructionPointer = leaderJumps ? op2[lead] : instructionPointer + 3;
+    }
+    else if(code == 7 || code == 8) { // less than & equals
+      const LaneValues op1 = param(1, mode1);
+      const LaneValues op2 = param(2, mode2);
+      LaneValues result;
+      if(code == 7) {
+        for(size_t lane = 0; lane < Lanes; lane++) result[lane] = op1[lane] < op2[lane];
+      } else {
+        for(size_t lane = 0; lane < Lanes; lane++) result[lane] = op1[lane] == op2[lane];
+      }
+      store(paramAddresses(3, mode3), result);
+      instructionPointer += 4;
+    }
+    else if(code == 9) { // adjusts relative base, lanes moving it elsewhere diverge
+      const LaneValues value = param(1, mode1);
+      for(size_t lane = 0; lane < Lanes; lane++) {
+        if(active[lane] && value[lane] != value[lead]) {
+          dropToScalar(lane, instructionPointer + 2, relativeBase + value[lane]);
+        }
+      }
+      relativeBase += value[lead];
+      instructionPointer += 2;
+    }
+    else {
+      cerr << "opCode not supported: " << leadInstruction % 100 << " at position: " << instructionPointer << "\n";
+      throw;
+    }
+    return true;
+  }
+};
+
+// Runs the program once per BatchRun, Lanes runs at a time in lockstep
+template<size_t Lanes = 8>
+vector<BatchResult> runBatch(const vector<IntCode> &program, const vector<BatchRun> &runs, const vector<size_t> &watchedCells = {}) {
+  vector<BatchResult> results;
+  results.reserve(runs.size());
+  for(size_t first = 0; first < runs.size(); first += Lanes) {
+    const size_t laneCount = min(Lanes, runs.size() - first);
+    IntcodeLockstep<Lanes> lockstep(program, runs.data() + first, laneCount, watchedCells);
+    auto laneResults = lockstep.run();
+    move(laneResults.begin(), laneResults.begin() + laneCount, back_inserter(results));
+  }
+  return results;
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include <iostream>
+#include <cstdio>
+#include "IntcodeImage.cpp"
+
+// Checkpoint of a whole VM: a fixed header, the pending inputs, the outputs
+// not consumed yet, the index of every touched memory page then the cells of
+// those pages. Every field is a
+// little-endian 64 bit word so the file can be shared between hosts. Memory
+// that was never written is not stored, saving and loading cost what the
+// program touched whatever its highest address.
+constexpr char intcodeCheckpointMagic[8] = {'I', 'N', 'T', 'C', 'K', 'P', 'T', '1'};
+struct IntcodeCheckpointHeader
+{
+  char magic[8];
+  uint64_t instructionPointer;
+  uint64_t relativeBase;
+  uint64_t terminated;
+  uint64_t inputCount;
+  uint64_t pageCount;
+  uint64_t cellCount; // memory size, up to the highest written address
+  uint64_t outputCount;
+};
+static_assert(sizeof(IntcodeCheckpointHeader) % sizeof(IntCode) == 0, "cells must stay aligned after the header");
+
+void storeLittleEndian(uint8_t *bytes, uint64_t value) {
+  for(size_t i = 0; i < 8; i++, value >>= 8) {
+    bytes[i] = static_cast<uint8_t>(value & 0xff);
+  }
+}
+
+// Written to a temporary file renamed over path, a run loading the
+// checkpoint meanwhile sees the old one or the new one
+void saveIntcodeCheckpoint(const IntcodeVM &vm, const string &path) {
+  vector<pair<size_t, const IntCode *>> pages;
+  vm.getMemory().forEachTouchedPage([&](size_t index, const IntCode *cells) { pages.push_back({index, cells}); });
+  queue<IntCode> inputs = vm.inputs;
+  const size_t inputsOffset = sizeof(IntcodeCheckpointHeader);
+  const size_t outputsOffset = inputsOffset + inputs.size() * 8;
+  const size_t indexesOffset = outputsOffset + vm.outputs.size() * 8;
+  const size_t cellsOffset = indexesOffset + pages.size() * 8;
+  const size_t length = cellsOffset + pages.size() * memoryPageSize * 8;
+
+  const string temporaryPath = path + ".tmp";
+  const int fd = open(temporaryPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0 || ftruncate(fd, length) != 0) {
+    cerr << "Cannot write Intcode checkpoint " << path << "\n";
+    throw;
+  }
+  void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED) {
+    cerr << "Cannot map Intcode checkpoint " << path << "\n";
+    throw;
+  }
+  uint8_t *bytes = static_cast<uint8_t *>(mapped);
+
+  memcpy(bytes, intcodeCheckpointMagic, sizeof(intcodeCheckpointMagic));
+  storeLittleEndian(bytes + 8, vm.getInstructionPointer());
+  storeLittleEndian(bytes + 16, static_cast<uint64_t>(vm.getRelativeBase()));
+  storeLittleEndian(bytes + 24, vm.terminated);
+  storeLittleEndian(bytes + 32, inputs.size());
+  storeLittleEndian(bytes + 40, pages.size());
+  storeLittleEndian(bytes + 48, vm.getMemory().size());
+  storeLittleEndian(bytes + 56, vm.outputs.size());
+  for(size_t i = 0; !inputs.empty(); i++, inputs.pop()) {
+    storeLittleEndian(bytes + inputsOffset + i * 8, static_cast<uint64_t>(inputs.front()));
+  }
+  for(size_t i = 0; i < vm.outputs.size(); i++) {
+    storeLittleEndian(bytes + outputsOffset + i * 8, static_cast<uint64_t>(vm.outputs[i]));
+  }
+  for(size_t p = 0; p < pages.size(); p++) {
+    storeLittleEndian(bytes + indexesOffset + p * 8, pages[p].first);
+    uint8_t *cells = bytes + cellsOffset + p * memoryPageSize * 8;
+    if(littleEndianHost()) {
+      memcpy(cells, pages[p].second, memoryPageSize * 8);
+      continue;
+    }
+    for(size_t i = 0; i < memoryPageSize; i++) {
+      storeLittleEndian(cells + i * 8, static_cast<uint64_t>(pages[p].second[i]));
+    }
+  }
+  munmap(mapped, length);
+  if(rename(temporaryPath.c_str(), path.c_str()) != 0) {
+    cerr << "Cannot write Intcode checkpoint " << path << "\n";
+    throw;
+  }
+}
+
+// Maps the checkpoint privately like an image: memory pages point into the
+// mapping and are only copied when the restored VM writes to them
+IntcodeVM loadIntcodeCheckpoint(const string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  struct stat info;
+  if(fd < 0 || fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(IntcodeCheckpointHeader)) {
+    cerr << "Cannot open Intcode checkpoint " << path << "\n";
+    throw;
+  }
+  const size_t length = info.st_size;
+  void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED) {
+    cerr << "Cannot map Intcode checkpoint " << path << "\n";
+    throw;
+  }
+  shared_ptr<void> mapping(mapped, [length](void *p) { munmap(p, length); });
+
+  uint8_t *bytes = static_cast<uint8_t *>(mapped);
+  const uint64_t inputCount = readLittleEndian(bytes + 32);
+  const uint64_t pageCount = readLittleEndian(bytes + 40);
+  const uint64_t outputCount = readLittleEndian(bytes + 56);
+  const size_t words = (length - sizeof(IntcodeCheckpointHeader)) / 8;
+  if(memcmp(bytes, intcodeCheckpointMagic, sizeof(intcodeCheckpointMagic)) != 0
+    || inputCount > words || outputCount > words - inputCount
+    || pageCount > (words - inputCount - outputCount) / (memoryPageSize + 1)) {
+    cerr << "Invalid Intcode checkpoint " << path << "\n";
+    throw;
+  }
+
+  queue<IntCode> inputs;
+  const uint8_t *inputBytes = bytes + sizeof(IntcodeCheckpointHeader);
+  for(size_t i = 0; i < inputCount; i++) {
+    inputs.push(static_cast<IntCode>(readLittleEndian(inputBytes + i * 8)));
+  }
+
+  const uint8_t *outputBytes = inputBytes + inputCount * 8;
+  vector<IntCode> outputs(outputCount);
+  for(size_t i = 0; i < outputCount; i++) {
+    outputs[i] = static_cast<IntCode>(readLittleEndian(outputBytes + i * 8));
+  }
+
+  const uint8_t *indexBytes = outputBytes + outputCount * 8;
+  IntCode *cells = reinterpret_cast<IntCode *>(bytes + sizeof(IntcodeCheckpointHeader) + (inputCount + outputCount + pageCount) * 8);
+  if(!littleEndianHost()) {
+    // Big-endian hosts decode the cells in place, the mapping is private
+    for(size_t i = 0; i < pageCount * memoryPageSize; i++) {
+      cells[i] = static_cast<IntCode>(readLittleEndian(reinterpret_cast<const uint8_t *>(cells + i)));
+    }
+  }
+  vector<pair<size_t, IntCode *>> pages(pageCount);
+  for(size_t p = 0; p < pageCount; p++) {
+    pages[p] = {readLittleEndian(indexBytes + p * 8), cells + p * memoryPageSize};
+  }
+
+  IntcodeVM vm(IntcodeMemory(pages, readLittleEndian(bytes + 48), move(mapping)),
+    readLittleEndian(bytes + 8), static_cast<IntCode>(readLittleEndian(bytes + 16)), move(inputs), readLittleEndian(bytes + 24) != 0);
+  vm.outputs = move(outputs);
+  return vm;
+}
+
+void testIntcodeCheckpoint() {
+  cout << "Intcode checkpoint test begin\n";
+
+  // Waits for its second input after writing near address 0 and far away
+  const auto program = parseIntcode("3,100,109,7,1101,5,6,1000000000,104,-1,3,101,1,100,101,102,4,1000000000,204,95,99");
+  IntcodeVM vm(program);
+  vm.inputs.push(30);
+  assert(!vm.resume().terminated && vm.waitingForInput());
+  vm.inputs.push(12);
+  vm.inputs.push(99);
+  const string path = "/tmp/intcode-checkpoint-test-" + to_string(getpid()) + ".bin";
+  saveIntcodeCheckpoint(vm, path);
+
+  // Two touched pages are stored, not the billion cells up to the far write
+  struct stat info {};
+  stat(path.c_str(), &info);
+  assert(static_cast<size_t>(info.st_size) == sizeof(IntcodeCheckpointHeader) + (2 + 1 + 2 + 2 * memoryPageSize) * 8);
+
+  IntcodeVM restored = loadIntcodeCheckpoint(path);
+  assert(restored.getInstructionPointer() == vm.getInstructionPointer() && restored.getRelativeBase() == 7);
+  assert(restored.read(1000000000) == 11 && restored.getMemory().size() == vm.getMemory().size());
+  assert(restored.resume().terminated && vm.resume().terminated);
+  assert(restored.outputs == vm.outputs && restored.outputs == parseIntcode("-1,11,42"));
+  assert(restored.inputs.size() == 1 && restored.inputs.front() == 99);
+
+  // Writes of the restored VM never reach the checkpoint
+  assert(restored.read(101) == 12 && loadIntcodeCheckpoint(path).read(101) == 0);
+  remove(path.c_str());
+  cout << "Intcode checkpoint test successful\n\n";
+}
@@ -1,8 +1,23 @@
+#pragma once
 #include <iostream>
 #include <cassert>
 #include <string>
 #include <vector>
 #include <queue>
+#include <array>
+#include <utility>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <map>
+#include <limits>
+#include <sys/mman.h>
 #include "utils.cpp"
 
 using IntCode = long long;
@@ -16,158 +31,1614 @@ struct ProgramState
   bool terminated = false;
 };
 
-ProgramState runProgram(const ProgramState initialState) {
-  ProgramState state {initialState};
+// Instructions are decoded once into a jump table index: opcode * 27 + the three
+// parameter modes in base 3. Index 0 means "not decoded yet", it is the slot of
+// the (invalid) opcode 0 so no real instruction ever decodes to it.
+using DecodedInstruction = uint16_t;
+constexpr DecodedInstruction notDecoded = 0;
+constexpr DecodedInstruction haltInstruction = 10 * 27;
+constexpr DecodedInstruction invalidInstruction = haltInstruction + 1;
+constexpr size_t instructionTableSize = invalidInstruction + 1;
+
+enum ParameterMode { PositionMode = 0, ImmediateMode = 1, RelativeMode = 2 };
+
+DecodedInstruction decodeInstruction(IntCode instruction) {
+  const IntCode code = instruction % 100;
+  if(code == 99) {
+    return haltInstruction;
+  }
+  if(instruction < 0 || code < 1 || code > 9) {
+    return invalidInstruction;
+  }
+  // Unknown mode digits behave as position mode
+  const auto mode = [](IntCode digit) { return digit == 1 || digit == 2 ? digit : 0; };
+  return code * 27 
+    + mode(instruction / 100 % 10) 
+    + mode(instruction / 1000 % 10) * 3 
+    + mode(instruction / 10000 % 10) * 9;
+}
+
+// Counts every Intcode memory page allocated, copies included, so tests can
+// check that resuming or forking a VM does not duplicate its memory
+atomic<size_t> intcodeMemoryAllocations {0};
 
-  const auto allocateMem = [&](size_t toAddress) { 
-    if(state.memory.size() <= toAddress) {
-      // cout << "out of bound memory access: " << toAddress << "\n";
-      for(size_t i = state.memory.size(); i <= toAddress; i++) {
-        state.memory.push_back(0);
+constexpr size_t memoryPageBits = 9;
+constexpr size_t memoryPageSize = size_t(1) << memoryPageBits;
+constexpr size_t memoryPageMask = memoryPageSize - 1;
+
+// Decoded entries are shared by every VM reading the page, they only ever
+// cache what the cell value already says so concurrent decodes agree.
+// Cells are either owned by the page or point into a mapped image (see
+// IntcodeImage.cpp) that the page keeps alive.
+template<typename Cell>
+struct BasicMemoryPage
+{
+  unique_ptr<Cell[]> storage {};
+  Cell *cells;
+  array<atomic<DecodedInstruction>, memoryPageSize> decoded {};
+  shared_ptr<void> mapping {};
+
+  BasicMemoryPage() : storage(new Cell[memoryPageSize]()), cells(storage.get()) { intcodeMemoryAllocations++; }
+  BasicMemoryPage(const BasicMemoryPage &other) : storage(new Cell[memoryPageSize]), cells(storage.get()) {
+    intcodeMemoryAllocations++;
+    copy(other.cells, other.cells + memoryPageSize, cells);
+    for(size_t i = 0; i < memoryPageSize; i++) {
+      decoded[i].store(other.decoded[i].load(memory_order_relaxed), memory_order_relaxed);
+    }
+  }
+  // Page over mapped cells, nothing is allocated for them
+  BasicMemoryPage(Cell *mappedCells, shared_ptr<void> mapping) : cells(mappedCells), mapping(move(mapping)) {}
+
+  size_t residentBytes() const {
+    return sizeof(BasicMemoryPage) + (storage ? memoryPageSize * sizeof(Cell) : 0);
+  }
+};
+using MemoryPage = BasicMemoryPage<IntCode>;
+
+// Untouched memory points to this page, it is never written, decoded entries
+// included: like any shared page it is copied on the first write
+template<typename Cell>
+const shared_ptr<BasicMemoryPage<Cell>> &zeroMemoryPage() {
+  static const shared_ptr<BasicMemoryPage<Cell>> page = make_shared<BasicMemoryPage<Cell>>();
+  return page;
+}
+
+// Largest memory copied into a flat vector, 128MB
+constexpr size_t maxFlatIntcodeCells = size_t(1) << 24;
+
+// Pages below this index live in a flat page table, the ones above (far
+// addresses) are kept in a hash map so a single far write costs a single page
+constexpr size_t maxDenseMemoryPages = 4096;
+
+// Paged memory shared copy-on-write between forked VMs: copying an
+// IntcodeMemory only copies page pointers, a page is duplicated the first time
+// one of its owners writes to it. Cells narrower than IntCode hold programs
+// whose values fit them, the image values are truncated otherwise.
+template<typename Cell>
+class BasicIntcodeMemory
+{
+public:
+  BasicIntcodeMemory() = default;
+  explicit BasicIntcodeMemory(const vector<IntCode> &image) {
+    for(size_t address = 0; address < image.size(); address++) {
+      writablePage(address).cells[address & memoryPageMask] = static_cast<Cell>(image[address]);
+    }
+    highWater = image.size();
+  }
+
+  // Same memory with another cell width, only the touched pages are converted
+  template<typename OtherCell>
+  explicit BasicIntcodeMemory(const BasicIntcodeMemory<OtherCell> &other) {
+    other.forEachTouchedPage([&](size_t index, const OtherCell *cells) {
+      copy(cells, cells + memoryPageSize, writablePage(index << memoryPageBits).cells);
+    });
+    highWater = other.size();
+  }
+
+  // Memory over count cells mapped by the caller, mapping keeps them alive.
+  // Full pages point into the mapping, only the last partial page is copied so
+  // no read goes past the mapped cells.
+  BasicIntcodeMemory(Cell *mappedCells, size_t count, shared_ptr<void> mapping) {
+    const size_t fullPages = count >> memoryPageBits;
+    for(size_t index = 0; index < fullPages; index++) {
+      pageSlot(index) = PageSlot(make_shared<BasicMemoryPage<Cell>>(mappedCells + (index << memoryPageBits), mapping));
+    }
+    for(size_t address = fullPages << memoryPageBits; address < count; address++) {
+      writablePage(address).cells[address & memoryPageMask] = mappedCells[address];
+    }
+    highWater = count;
+  }
+
+  // Memory over touched pages mapped by the caller (see IntcodeCheckpoint.cpp),
+  // mapping keeps them alive
+  BasicIntcodeMemory(const vector<pair<size_t, Cell *>> &mappedPages, size_t count, shared_ptr<void> mapping) {
+    for(const auto &[index, cells] : mappedPages) {
+      pageSlot(index) = PageSlot(make_shared<BasicMemoryPage<Cell>>(cells, mapping));
+    }
+    highWater = count;
+  }
+
+  // Reads never allocate, cells outside of the allocated pages are zero
+  Cell read(size_t address) const {
+    const size_t index = address >> memoryPageBits;
+    if(index < pages.size()) {
+      return pages[index].cells[address & memoryPageMask];
+    }
+    const PageSlot *slot = farPage(index);
+    return slot ? slot->cells[address & memoryPageMask] : 0;
+  }
+
+  void write(size_t address, Cell value) {
+    BasicMemoryPage<Cell> &p = writablePage(address);
+    p.cells[address & memoryPageMask] = value;
+    p.decoded[address & memoryPageMask].store(notDecoded, memory_order_relaxed);
+  }
+
+  DecodedInstruction decoded(size_t address) const {
+    const size_t index = address >> memoryPageBits;
+    const PageSlot *slot = index < pages.size() ? &pages[index] : farPage(index);
+    return slot ? slot->page->decoded[address & memoryPageMask].load(memory_order_relaxed) : notDecoded;
+  }
+
+  void cacheDecoded(size_t address, DecodedInstruction instruction) {
+    const size_t index = address >> memoryPageBits;
+    const PageSlot *slot = index < pages.size() ? &pages[index] : farPage(index);
+    if(slot && slot->page != zeroMemoryPage<Cell>()) {
+      slot->page->decoded[address & memoryPageMask].store(instruction, memory_order_relaxed);
+    }
+  }
+
+  // Number of cells up to the highest written address
+  size_t size() const { return highWater; }
+
+  // Flat copy for the ProgramState API, refused past maxFlatIntcodeCells: far
+  // addresses would make it allocate the whole address space below them
+  vector<IntCode> toVector() const {
+    if(highWater > maxFlatIntcodeCells) {
+      cerr << "Intcode memory too large to flatten: " << highWater << " cells, keep the VM instead of its ProgramState\n";
+      throw;
+    }
+    vector<IntCode> flat(highWater);
+    for(size_t address = 0; address < highWater; address++) {
+      flat[address] = read(address);
+    }
+    return flat;
+  }
+
+  // Pages owned by this memory only, the ones a fork had to duplicate
+  size_t ownedPages() const {
+    const auto owned = [](const PageSlot &slot) { return slot.page.use_count() == 1; };
+    return count_if(pages.cbegin(), pages.cend(), owned)
+      + count_if(farPages.cbegin(), farPages.cend(), [&](const auto &entry) { return owned(entry.second); });
+  }
+
+  // Pages this memory had to allocate or duplicate so far
+  size_t allocatedPages() const { return pageAllocations; }
+
+  // Visits the pages holding written cells, untouched ones all share the
+  // zero page and are skipped
+  template<typename Visit>
+  void forEachTouchedPage(Visit visit) const {
+    for(size_t index = 0; index < pages.size(); index++) {
+      if(pages[index].page != zeroMemoryPage<Cell>()) {
+        visit(index, pages[index].cells);
+      }
+    }
+    for(const auto &[index, slot] : farPages) {
+      if(slot.page != zeroMemoryPage<Cell>()) {
+        visit(index, slot.cells);
       }
     }
+  }
+
+  // Flat page table read by JIT compiled code: entry i starts with the cells
+  // pointer of page i. Any write may move it.
+  const void *densePageTable() const { return pages.data(); }
+  size_t densePageCount() const { return pages.size(); }
+  static constexpr size_t densePageStride() { return sizeof(PageSlot); }
+
+  size_t residentBytes() const {
+    size_t bytes = pages.capacity() * sizeof(PageSlot) + farPages.size() * (sizeof(size_t) + sizeof(PageSlot));
+    for(const PageSlot &slot : pages) {
+      bytes += slot.page.use_count() == 1 ? slot.page->residentBytes() : 0;
+    }
+    for(const auto &entry : farPages) {
+      bytes += entry.second.page.use_count() == 1 ? entry.second.page->residentBytes() : 0;
+    }
+    return bytes;
+  }
+
+private:
+  // The cells pointer is cached next to the page so reads take a single
+  // indirection, it comes first for the code the JIT emits
+  struct PageSlot
+  {
+    Cell *cells;
+    shared_ptr<BasicMemoryPage<Cell>> page;
+    explicit PageSlot(shared_ptr<BasicMemoryPage<Cell>> p = zeroMemoryPage<Cell>()) : cells(p->cells), page(move(p)) {}
   };
 
-  const auto memWrite = [&](size_t address, IntCode value) {
-    allocateMem(address);
-    state.memory.at(address) = value;
+  vector<PageSlot> pages {};
+  unordered_map<size_t, PageSlot> farPages {};
+  size_t highWater = 0;
+  size_t pageAllocations = 0;
+
+  const PageSlot *farPage(size_t index) const {
+    if(farPages.empty()) {
+      return nullptr;
+    }
+    const auto p = farPages.find(index);
+    return p != farPages.cend() ? &p->second : nullptr;
+  }
+
+  PageSlot &pageSlot(size_t index) {
+    if(index < pages.size()) {
+      return pages[index];
+    }
+    if(index < maxDenseMemoryPages) {
+      pages.resize(index + 1);
+      return pages[index];
+    }
+    return farPages.try_emplace(index).first->second;
+  }
+
+  BasicMemoryPage<Cell> &writablePage(size_t address) {
+    if(address >= highWater) {
+      highWater = address + 1;
+    }
+    PageSlot &slot = pageSlot(address >> memoryPageBits);
+    if(slot.page.use_count() > 1) {
+      slot = PageSlot(make_shared<BasicMemoryPage<Cell>>(*slot.page));
+      pageAllocations++;
+    }
+    return *slot.page;
+  }
+};
+using IntcodeMemory = BasicIntcodeMemory<IntCode>;
+
+uint64_t hashIntcode(const vector<IntCode> &cells, uint64_t hash = 14695981039346656037ull) {
+  for(const IntCode cell : cells) {
+    hash = (hash ^ static_cast<uint64_t>(cell)) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// Programs compiled ahead of time by intcode-aot register their native code
+// here. A VM built from a registered image runs it, and hands over to the
+// interpreter where the native code stops: computed jumps to addresses it did
+// not compile, and writes changing a compiled instruction.
+enum class IntcodeNativeExit { Halted, Paused, Interpret };
+struct IntcodeNativeFrame;
+
+struct IntcodeNativeProgram
+{
+  uint64_t hash;
+  size_t cellCount;
+  IntcodeNativeExit (*run)(IntcodeNativeFrame &);
+  vector<pair<size_t, IntCode>> codeCells; // compiled cells and their value in the image
+  vector<bool> isCodeCell {};
+};
+
+vector<const IntcodeNativeProgram *> &nativeIntcodePrograms() {
+  static vector<const IntcodeNativeProgram *> programs;
+  return programs;
+}
+
+bool registerNativeIntcode(IntcodeNativeProgram &program) {
+  program.isCodeCell.assign(program.cellCount, false);
+  for(const auto &[address, value] : program.codeCells) {
+    program.isCodeCell[address] = true;
+  }
+  nativeIntcodePrograms().push_back(&program);
+  return true;
+}
+
+const IntcodeNativeProgram *findNativeIntcode(const vector<IntCode> &image) {
+  if(nativeIntcodePrograms().empty()) {
+    return nullptr;
+  }
+  const uint64_t hash = hashIntcode(image);
+  for(const IntcodeNativeProgram *program : nativeIntcodePrograms()) {
+    if(program->hash == hash && program->cellCount == image.size()) {
+      return program;
+    }
+  }
+  return nullptr;
+}
+
+// State the native code runs on, the instruction pointer and relative base
+// are written back by exit()
+struct IntcodeNativeFrame
+{
+  IntcodeMemory &memory;
+  const IntcodeNativeProgram &program;
+  size_t instructionPointer;
+  IntCode relativeBase;
+  void *vm;
+  optional<IntCode> (*input)(void *vm);
+  bool (*output)(void *vm, IntCode value); // false when the VM must pause
+  bool codeModified = false;
+
+  IntCode read(IntCode address) const {
+    if(address < 0) {
+      cerr << "Illegal program memory access: negative address\n";
+      throw;
+    }
+    return memory.read(address);
+  }
+
+  // False when the write changed a compiled instruction, the native code must stop there
+  bool write(IntCode address, IntCode value) {
+    if(address < 0) {
+      cerr << "Illegal program memory access: negative address\n";
+      throw;
+    }
+    const size_t cell = address;
+    if(cell < program.isCodeCell.size() && program.isCodeCell[cell] && memory.read(cell) != value) {
+      codeModified = true;
+    }
+    memory.write(cell, value);
+    return !codeModified;
+  }
+
+  IntcodeNativeExit exit(IntcodeNativeExit reason, size_t nextInstruction, IntCode rb) {
+    instructionPointer = nextInstruction;
+    relativeBase = rb;
+    return reason;
+  }
+};
+
+// Tier of new VMs: after jitWarmUp basic blocks the interpreter counts block
+// entries. Once a block was entered jitThreshold times the JIT compiles it to
+// x86-64, and with the loop tier counting loops starting there are
+// fast-forwarded. INTCODE_JIT=0 in the environment turns the JIT off,
+// INTCODE_LOOPS=1 turns the loop tier on: no puzzle input has a loop it
+// applies to.
+bool intcodeEnvironmentFlag(const char *name, bool byDefault) {
+  const char *value = getenv(name);
+  return value == nullptr ? byDefault : strcmp(value, "0") != 0;
+}
+
+struct IntcodeTierSettings
+{
+  bool jit;
+  uint32_t jitThreshold;
+  size_t jitWarmUp;
+  bool loops;
+};
+IntcodeTierSettings intcodeTiers {intcodeEnvironmentFlag("INTCODE_JIT", true), 16, 1024, intcodeEnvironmentFlag("INTCODE_LOOPS", false)};
+
+// Counting loop: one basic block of additions and compares jumping back to
+// its own start. When every write adds a loop invariant step to a cell
+// (counter) or stores a compare result (flag) only the jump reads, each
+// value the loop reads is affine in the iteration number, so the iteration
+// it exits at and the memory it leaves behind have a closed form.
+struct IntcodeAffineLoop
+{
+  struct Instruction
+  {
+    int code;
+    int modes[3];
+    IntCode operands[3];
   };
 
-  const auto memRead = [&](size_t address) {
-    allocateMem(address);
-    return state.memory.at(address);
+  size_t start;
+  size_t end; // address after the jump
+  vector<Instruction> body; // the jump comes last
+  // Relative base the loop was found not affine for. Aliasing only depends on
+  // the addresses the loop resolves, so entries with the same relative base
+  // are turned down without analysing them again.
+  mutable optional<IntCode> rejectedRelativeBase {};
+
+  // Cells the loop leaves behind and the number of iterations it ran,
+  // nullopt when it is not affine for this memory and relative base, or when
+  // it would end after its first iteration or never
+  optional<pair<vector<pair<size_t, IntCode>>, uint64_t>> exitState(const IntcodeMemory &memory, IntCode relativeBase) const {
+    if(rejectedRelativeBase == relativeBase) {
+      return nullopt;
+    }
+    const auto reject = [&]() {
+      rejectedRelativeBase = relativeBase;
+      return nullopt;
+    };
+    using Wide = __int128;
+    struct Operand
+    {
+      bool isCell;
+      size_t address;
+      IntCode value;
+    };
+    struct Affine // a + b * iteration
+    {
+      Wide a;
+      Wide b;
+    };
+
+    // Resolves every operand, the write is the last one of additions and compares
+    vector<array<Operand, 3>> resolved;
+    for(const Instruction &instruction : body) {
+      array<Operand, 3> operands {};
+      const int count = instruction.code == 5 || instruction.code == 6 ? 1 : 3;
+      for(int i = 0; i < count; i++) {
+        const IntCode address = instruction.modes[i] == RelativeMode ? instruction.operands[i] + relativeBase : instruction.operands[i];
+        if(instruction.modes[i] != ImmediateMode && address < 0) {
+          return reject();
+        }
+        operands[i] = instruction.modes[i] == ImmediateMode
+          ? Operand {false, 0, instruction.operands[i]}
+          : Operand {true, size_t(address), memory.read(address)};
+      }
+      resolved.push_back(operands);
+    }
+
+    // Which instruction writes each cell, cells are written once and never in the loop code
+    unordered_map<size_t, size_t> writer;
+    for(size_t i = 0; i + 1 < body.size(); i++) {
+      const size_t target = resolved[i][2].address;
+      if((target >= start && target < end) || !writer.emplace(target, i).second) {
+        return reject();
+      }
+    }
+    const auto writtenBy = [&](const Operand &operand) -> optional<size_t> {
+      if(!operand.isCell) return nullopt;
+      const auto w = writer.find(operand.address);
+      return w != writer.end() ? optional<size_t>(w->second) : nullopt;
+    };
+
+    // Counters step by a constant or an unwritten cell, flags are only read by the jump
+    vector<Wide> steps(body.size(), 0);
+    for(size_t i = 0; i + 1 < body.size(); i++) {
+      const auto &operands = resolved[i];
+      if(body[i].code == 1) {
+        const bool first = operands[0].isCell && operands[0].address == operands[2].address;
+        const bool second = operands[1].isCell && operands[1].address == operands[2].address;
+        const Operand &step = first ? operands[1] : operands[0];
+        if(first == second || writtenBy(step)) {
+          return reject();
+        }
+        steps[i] = step.value;
+      }
+      for(int p = 0; p < 2; p++) {
+        const auto w = writtenBy(operands[p]);
+        if(w && body[*w].code != 1) {
+          return reject();
+        }
+      }
+    }
+
+    // Value read at body position p during an iteration
+    const auto affine = [&](const Operand &operand, size_t p) {
+      const auto w = writtenBy(operand);
+      if(!w) return Affine {operand.value, 0};
+      return Affine {Wide(operand.value) + (*w < p ? steps[*w] : 0), steps[*w]};
+    };
+
+    // First iteration whose jump falls through: a + b * k is below zero,
+    // at least zero, zero or not zero
+    enum Exit { Below, AtLeast, Zero, NotZero };
+    const auto firstIteration = [](Affine f, Exit exit) -> optional<Wide> {
+      switch(exit) {
+        case Below: return f.a < 0 ? optional<Wide>(0) : f.b < 0 ? optional<Wide>(f.a / -f.b + 1) : nullopt;
+        case AtLeast: return f.a >= 0 ? optional<Wide>(0) : f.b > 0 ? optional<Wide>((-f.a + f.b - 1) / f.b) : nullopt;
+        case Zero: return f.a == 0 ? optional<Wide>(0) : f.b != 0 && -f.a % f.b == 0 && -f.a / f.b > 0 ? optional<Wide>(-f.a / f.b) : nullopt;
+        default: return f.a != 0 ? optional<Wide>(0) : f.b != 0 ? optional<Wide>(1) : nullopt;
+      }
+    };
+    const auto flagAt = [&](size_t i, Wide k) -> IntCode {
+      const Affine lhs = affine(resolved[i][0], i), rhs = affine(resolved[i][1], i);
+      const Wide difference = lhs.a - rhs.a + (lhs.b - rhs.b) * k;
+      return body[i].code == 7 ? difference < 0 : difference == 0;
+    };
+
+    const size_t jump = body.size() - 1;
+    const bool jumpIfTrue = body[jump].code == 5;
+    const auto condition = writtenBy(resolved[jump][0]);
+    optional<Wide> exitIteration;
+    if(condition && body[*condition].code != 1) {
+      const size_t i = *condition;
+      const Affine lhs = affine(resolved[i][0], i), rhs = affine(resolved[i][1], i);
+      const Affine difference {lhs.a - rhs.a, lhs.b - rhs.b};
+      exitIteration = body[i].code == 7
+        ? firstIteration(difference, jumpIfTrue ? AtLeast : Below)
+        : firstIteration(difference, jumpIfTrue ? NotZero : Zero);
+    } else {
+      exitIteration = firstIteration(affine(resolved[jump][0], jump), jumpIfTrue ? Zero : NotZero);
+    }
+    if(!exitIteration || *exitIteration == 0 || *exitIteration >= Wide(1) << 62) {
+      return nullopt;
+    }
+
+    vector<pair<size_t, IntCode>> writes;
+    for(const auto &[address, i] : writer) {
+      if(body[i].code == 1) {
+        const Wide value = resolved[i][2].value + steps[i] * (*exitIteration + 1);
+        if(value > numeric_limits<IntCode>::max() || value < numeric_limits<IntCode>::min()) {
+          return nullopt;
+        }
+        writes.push_back({address, IntCode(value)});
+      } else {
+        writes.push_back({address, flagAt(i, *exitIteration)});
+      }
+    }
+    return make_pair(writes, uint64_t(*exitIteration + 1));
+  }
+};
+
+// A counting loop starting at start, if there is one
+optional<IntcodeAffineLoop> findAffineLoop(const IntcodeMemory &memory, size_t start) {
+  constexpr size_t maxLoopInstructions = 16;
+  IntcodeAffineLoop loop {start, start, {}};
+  size_t pc = start;
+  while(loop.body.size() < maxLoopInstructions) {
+    const DecodedInstruction decoded = decodeInstruction(memory.read(pc));
+    const int code = decoded / 27;
+    const IntcodeAffineLoop::Instruction instruction {code, {decoded % 3, decoded / 3 % 3, decoded / 9 % 3},
+      {memory.read(pc + 1), memory.read(pc + 2), memory.read(pc + 3)}};
+    if(decoded != haltInstruction && decoded != invalidInstruction && (code == 1 || code == 7 || code == 8) && instruction.modes[2] != ImmediateMode) {
+      loop.body.push_back(instruction);
+      pc += 4;
+      continue;
+    }
+    if(decoded != haltInstruction && decoded != invalidInstruction && (code == 5 || code == 6)
+      && instruction.modes[1] == ImmediateMode && instruction.operands[1] == IntCode(start)) {
+      loop.body.push_back(instruction);
+      loop.end = pc + 3;
+      return loop;
+    }
+    break;
+  }
+  return nullopt;
+}
+
+class IntcodeJit;
+
+// What compiled blocks read, the layout is part of the generated code
+struct IntcodeJitContext
+{
+  const void *densePages;
+  size_t densePageCount;
+  IntCode relativeBase;
+  IntcodeMemory *memory;
+  IntcodeJit *jit;
+  bool faulted; // the interpreter runs the instruction again to report it
+};
+
+// Compiled basic blocks of one VM, never shared with its forks since their
+// code may diverge. A block is a run of arithmetic, compare and relative base
+// instructions, ending with a jump or before any other instruction. Writing
+// into the code of a block drops it for good (guard), the interpreter runs
+// the cell from then on. Only built on x86-64 Linux, blocks are never
+// compiled elsewhere.
+class IntcodeJit
+{
+public:
+  using BlockCode = size_t (*)(IntcodeJitContext *);
+
+  explicit IntcodeJit(const IntcodeTierSettings &settings) : settings(settings) {}
+  IntcodeJit(const IntcodeJit &) = delete;
+  IntcodeJit &operator=(const IntcodeJit &) = delete;
+  ~IntcodeJit() {
+    for(const auto &[chunk, size] : chunks) {
+      munmap(chunk, size);
+    }
+  }
+
+  BlockCode blockAt(size_t address) const {
+    return address < entries.size() ? entries[address].code : nullptr;
+  }
+
+  const IntcodeAffineLoop *loopAt(size_t address) const {
+    return address < entries.size() ? entries[address].loop.get() : nullptr;
+  }
+
+  // Counts an entry in the block starting at address, compiles it once hot
+  void enter(const IntcodeMemory &memory, size_t address) {
+    if(address >= maxJitAddress) {
+      return;
+    }
+    if(address >= entries.size()) {
+      entries.resize(address + 1);
+    }
+    Entry &entry = entries[address];
+    if(entry.rejected || entry.code || entry.loop || ++entry.count < max<uint32_t>(settings.jitThreshold, 1)) {
+      return;
+    }
+    size_t end = address;
+    if(settings.loops) {
+      if(auto loop = findAffineLoop(memory, address)) {
+        end = loop->end;
+        entry.loop = make_unique<IntcodeAffineLoop>(move(*loop));
+      }
+    }
+    if(settings.jit) {
+      entry.code = compile(memory, address, end);
+    }
+    entry.rejected = !entry.code && !entry.loop;
+    if(!entry.rejected) {
+      guard(address, end);
+    }
+  }
+
+  bool guards(size_t address) const {
+    return address < guarded.size() && guarded[address] > 0;
+  }
+
+  // Drops the blocks covering a cell about to be rewritten
+  void invalidate(size_t address) {
+    auto block = blocks.lower_bound(address >= maxBlockCells ? address - maxBlockCells : 0);
+    while(block != blocks.end() && block->first <= address) {
+      if(address < block->second) {
+        for(size_t cell = block->first; cell < block->second; cell++) {
+          guarded[cell]--;
+        }
+        entries[block->first].code = nullptr;
+        entries[block->first].loop.reset();
+        entries[block->first].rejected = true;
+        block = blocks.erase(block);
+      } else {
+        ++block;
+      }
+    }
+  }
+
+  size_t compiledBlocks() const { return blocks.size(); }
+
+  // Loop iterations skipped so far
+  uint64_t fastForwarded = 0;
+
+private:
+  struct Entry
+  {
+    BlockCode code = nullptr;
+    unique_ptr<IntcodeAffineLoop> loop {};
+    uint32_t count = 0;
+    bool rejected = false;
   };
 
-  bool run = true;
-  while(run) {
-    const string instruction = to_string(state.memory.at(state.instructionPointer));
-    const size_t code = instruction.size() > 2 
-      ? stoi(instruction.substr(instruction.size() - 2))
-      : stoi(instruction);
-    
-    const string parametersMode = instruction.size() > 2
-      ? instruction.substr(0, instruction.size() - 2)
-      : "";
-
-    const auto getParamValueAdress = [&](size_t paramNumber){
-      const int parametersModeIndex = parametersMode.size() - paramNumber;
-      const bool isImmediateMode = parametersModeIndex >= 0 ? parametersMode.at(parametersModeIndex) == '1' : false;
-      const bool isRelativeMode = parametersModeIndex >= 0 ? parametersMode.at(parametersModeIndex) == '2' : false;
-      
-      IntCode address = state.memory.at(state.instructionPointer + paramNumber);
-      if (isImmediateMode) {
-        address = state.instructionPointer + paramNumber;
-      }
-      else if (isRelativeMode) {
-        address = state.relativeBase + state.memory.at(state.instructionPointer + paramNumber); 
+  static constexpr size_t maxBlockInstructions = 64;
+  static constexpr size_t maxBlockCells = maxBlockInstructions * 4;
+  static constexpr size_t maxJitAddress = size_t(1) << 20;
+  static constexpr size_t chunkSize = size_t(1) << 16;
+
+  IntcodeTierSettings settings;
+  vector<Entry> entries {};
+  map<size_t, size_t> blocks {}; // start -> end of the compiled cells
+  vector<uint16_t> guarded {};
+  vector<pair<uint8_t *, size_t>> chunks {};
+  size_t chunkUsed = 0;
+
+  // Null when nothing could be compiled, end is pushed past the compiled cells
+  BlockCode compile(const IntcodeMemory &memory, size_t start, size_t &end);
+
+  // Executable memory is only writable while a block is copied in
+  BlockCode install(const vector<uint8_t> &code) {
+    if(chunks.empty() || chunkUsed + code.size() > chunks.back().second) {
+      const size_t size = max(chunkSize, code.size());
+      void *chunk = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(chunk == MAP_FAILED) {
+        return nullptr;
       }
+      chunks.push_back({static_cast<uint8_t *>(chunk), size});
+      chunkUsed = 0;
+    }
+    uint8_t *chunk = chunks.back().first;
+    if(mprotect(chunk, chunks.back().second, PROT_READ | PROT_WRITE) != 0) {
+      return nullptr;
+    }
+    memcpy(chunk + chunkUsed, code.data(), code.size());
+    mprotect(chunk, chunks.back().second, PROT_READ | PROT_EXEC);
+    const BlockCode block = reinterpret_cast<BlockCode>(chunk + chunkUsed);
+    chunkUsed += (code.size() + 15) & ~size_t(15);
+    return block;
+  }
 
+  void guard(size_t start, size_t end) {
+    blocks.emplace(start, end);
+    if(end > guarded.size()) {
+      guarded.resize(end);
+    }
+    for(size_t cell = start; cell < end; cell++) {
+      guarded[cell]++;
+    }
+  }
+};
+
+// Called from compiled blocks, writes return 0 when done, 1 on a negative
+// address and 2 when they hit compiled code
+IntCode intcodeJitRead(const IntcodeMemory *memory, size_t address) {
+  return memory->read(address);
+}
+
+int intcodeJitWrite(IntcodeJitContext *context, IntCode address, IntCode value) {
+  if(address < 0) {
+    context->faulted = true;
+    return 1;
+  }
+  IntcodeMemory &memory = *context->memory;
+  int result = 0;
+  if(context->jit->guards(address) && memory.read(address) != value) {
+    context->jit->invalidate(address);
+    result = 2;
+  }
+  memory.write(address, value);
+  context->densePages = memory.densePageTable();
+  context->densePageCount = memory.densePageCount();
+  return result;
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+// Machine code of one block, System V calling convention. rbx holds the
+// context, r12 the relative base, r13 and r14 the operands, the block returns
+// the next instruction pointer in rax.
+class IntcodeJitAssembler
+{
+public:
+  enum Register { rax = 0, rcx = 1, rdx = 2, rbx = 3, rsi = 6, rdi = 7, r11 = 11, r12 = 12, r13 = 13, r14 = 14, r15 = 15 };
+
+  vector<uint8_t> code {};
+
+  int newLabel() {
+    labels.push_back(0);
+    return labels.size() - 1;
+  }
+  void bind(int label) { labels[label] = code.size(); }
+
+  // Jumps always take a 32 bit displacement, patched by finish()
+  void jump(int label) { emit({0xE9}); fixup(label); }
+  void jumpIf(uint8_t condition, int label) { emit({0x0F, uint8_t(0x80 | condition)}); fixup(label); }
+
+  vector<uint8_t> &finish() {
+    for(const auto &[at, label] : fixups) {
+      const int32_t displacement = int32_t(labels[label]) - int32_t(at + 4);
+      memcpy(&code[at], &displacement, 4);
+    }
+    return code;
+  }
+
+  void emit(initializer_list<uint8_t> bytes) { code.insert(code.end(), bytes); }
+
+  // op reg, rm with both operands registers
+  void registers(initializer_list<uint8_t> opcode, int reg, int rm) {
+    emit({uint8_t(0x48 | (reg >> 3) << 2 | rm >> 3)});
+    emit(opcode);
+    emit({uint8_t(0xC0 | (reg & 7) << 3 | (rm & 7))});
+  }
+  void move(int to, int from) { registers({0x89}, from, to); }
+  void add(int to, int from) { registers({0x01}, from, to); }
+  void multiply(int to, int from) { registers({0x0F, 0xAF}, to, from); }
+  void compare(int left, int right) { registers({0x39}, right, left); }
+  void test(int reg) { registers({0x85}, reg, reg); }
+
+  void moveImmediate(int reg, IntCode value) {
+    emit({uint8_t(0x48 | reg >> 3), uint8_t(0xB8 + (reg & 7))});
+    code.insert(code.end(), reinterpret_cast<const uint8_t *>(&value), reinterpret_cast<const uint8_t *>(&value) + 8);
+  }
+
+  // reg <-> [rbx + offset], offset below 128
+  void loadContext(int reg, size_t offset) { emit({uint8_t(0x48 | (reg >> 3) << 2), 0x8B, uint8_t(0x43 | (reg & 7) << 3), uint8_t(offset)}); }
+  void storeContext(size_t offset, int reg) { emit({uint8_t(0x48 | (reg >> 3) << 2), 0x89, uint8_t(0x43 | (reg & 7) << 3), uint8_t(offset)}); }
+
+  void call(const void *function) {
+    moveImmediate(r11, reinterpret_cast<IntCode>(function));
+    emit({0x41, 0xFF, 0xD3});
+  }
+
+private:
+  vector<size_t> labels {};
+  vector<pair<size_t, int>> fixups {};
+
+  void fixup(int label) {
+    fixups.push_back({code.size(), label});
+    emit({0, 0, 0, 0});
+  }
+};
+
+constexpr uint8_t conditionEqual = 0x4, conditionNotEqual = 0x5, conditionAboveOrEqual = 0x3, conditionSign = 0x8;
+
+IntcodeJit::BlockCode IntcodeJit::compile(const IntcodeMemory &memory, size_t start, size_t &end) {
+  using A = IntcodeJitAssembler;
+  static_assert(IntcodeMemory::densePageStride() < 128 && offsetof(IntcodeJitContext, faulted) < 128, "displacements are encoded on a byte");
+  A a;
+  const int epilogue = a.newLabel();
+
+  // Prologue, five pushes keep the stack aligned for calls
+  a.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+  a.move(A::rbx, A::rdi);
+  a.loadContext(A::r12, offsetof(IntcodeJitContext, relativeBase));
+
+  // rax = cell at address rax, returning pc when the address is negative
+  const auto readCell = [&](size_t pc) {
+    const int valid = a.newLabel(), far = a.newLabel(), done = a.newLabel();
+    a.test(A::rax);
+    a.jumpIf(conditionSign ^ 1, valid);
+    a.emit({0xC6, 0x43, uint8_t(offsetof(IntcodeJitContext, faulted)), 1}); // mov byte faulted, 1
+    a.moveImmediate(A::rax, pc);
+    a.jump(epilogue);
+    a.bind(valid);
+    a.move(A::rcx, A::rax);
+    a.emit({0x48, 0xC1, 0xE9, memoryPageBits});                        // shr rcx, pageBits
+    a.emit({0x48, 0x3B, 0x4B, uint8_t(offsetof(IntcodeJitContext, densePageCount))}); // cmp rcx, count
+    a.jumpIf(conditionAboveOrEqual, far);
+    a.loadContext(A::rdx, offsetof(IntcodeJitContext, densePages));
+    a.emit({0x48, 0x6B, 0xC9, uint8_t(IntcodeMemory::densePageStride())}); // imul rcx, stride
+    a.emit({0x48, 0x8B, 0x14, 0x0A});                                  // mov rdx, [rdx + rcx]
+    a.emit({0x25});                                                    // and eax, pageMask
+    const uint32_t mask = memoryPageMask;
+    a.code.insert(a.code.end(), reinterpret_cast<const uint8_t *>(&mask), reinterpret_cast<const uint8_t *>(&mask) + 4);
+    a.emit({0x48, 0x8B, 0x04, 0xC2});                                  // mov rax, [rdx + rax * 8]
+    a.jump(done);
+    a.bind(far);
+    a.move(A::rsi, A::rax);
+    a.loadContext(A::rdi, offsetof(IntcodeJitContext, memory));
+    a.call(reinterpret_cast<const void *>(&intcodeJitRead));
+    a.bind(done);
+  };
+  // rax = address of a parameter
+  const auto loadAddress = [&](IntCode operand, int mode) {
+    a.moveImmediate(A::rax, operand);
+    if(mode == RelativeMode) {
+      a.add(A::rax, A::r12);
+    }
+  };
+  const auto loadValue = [&](int reg, size_t pc, IntCode operand, int mode) {
+    if(mode == ImmediateMode) {
+      a.moveImmediate(reg, operand);
+      return;
+    }
+    loadAddress(operand, mode);
+    readCell(pc);
+    if(reg != A::rax) {
+      a.move(reg, A::rax);
+    }
+  };
+  // Writes rdx, leaving the block when the write did not simply happen
+  const auto writeCell = [&](size_t pc, size_t next, IntCode operand, int mode) {
+    const int written = a.newLabel();
+    if(mode == ImmediateMode) {
+      a.moveImmediate(A::rax, operand);
+    } else {
+      loadAddress(operand, mode);
+    }
+    a.move(A::rsi, A::rax);
+    a.move(A::rdi, A::rbx);
+    a.call(reinterpret_cast<const void *>(&intcodeJitWrite));
+    a.emit({0x85, 0xC0});                                              // test eax, eax
+    a.jumpIf(conditionEqual, written);
+    a.emit({0x83, 0xF8, 0x01});                                        // cmp eax, 1
+    a.moveImmediate(A::rax, pc);
+    a.jumpIf(conditionEqual, epilogue);
+    a.moveImmediate(A::rax, next);
+    a.jump(epilogue);
+    a.bind(written);
+  };
+
+  size_t pc = start;
+  bool jumped = false;
+  for(size_t count = 0; count < maxBlockInstructions && !jumped; count++) {
+    const DecodedInstruction decoded = decodeInstruction(memory.read(pc));
+    const int code = decoded / 27;
+    const int mode1 = decoded % 3, mode2 = decoded / 3 % 3, mode3 = decoded / 9 % 3;
+    if(decoded == haltInstruction || decoded == invalidInstruction || code == 3 || code == 4) {
+      break;
+    }
+    if(code == 1 || code == 2 || code == 7 || code == 8) {
+      loadValue(A::r13, pc, memory.read(pc + 1), mode1);
+      loadValue(A::r14, pc, memory.read(pc + 2), mode2);
+      if(code == 1 || code == 2) {
+        a.move(A::rdx, A::r13);
+        code == 1 ? a.add(A::rdx, A::r14) : a.multiply(A::rdx, A::r14);
+      } else {
+        a.compare(A::r13, A::r14);
+        a.emit({0x0F, uint8_t(code == 7 ? 0x9C : 0x94), 0xC0});        // setl / sete al
+        a.emit({0x0F, 0xB6, 0xD0});                                    // movzx edx, al
+      }
+      writeCell(pc, pc + 4, mode3 == ImmediateMode ? IntCode(pc + 3) : memory.read(pc + 3), mode3);
+      pc += 4;
+    }
+    else if(code == 5 || code == 6) {
+      const int notTaken = a.newLabel();
+      loadValue(A::r13, pc, memory.read(pc + 1), mode1);
+      a.test(A::r13);
+      a.jumpIf(code == 5 ? conditionEqual : conditionNotEqual, notTaken);
+      loadValue(A::rax, pc, memory.read(pc + 2), mode2);
+      a.jump(epilogue);
+      a.bind(notTaken);
+      pc += 3;
+      jumped = true;
+    }
+    else if(code == 9) {
+      loadValue(A::rax, pc, memory.read(pc + 1), mode1);
+      a.add(A::r12, A::rax);
+      pc += 2;
+    }
+  }
+  if(pc == start) {
+    return nullptr;
+  }
+  a.moveImmediate(A::rax, pc);
+
+  a.bind(epilogue);
+  a.storeContext(offsetof(IntcodeJitContext, relativeBase), A::r12);
+  a.emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+  const BlockCode block = install(a.finish());
+  if(block) {
+    end = max(end, pc);
+  }
+  return block;
+}
+#else
+IntcodeJit::BlockCode IntcodeJit::compile(const IntcodeMemory &, size_t, size_t &) {
+  return nullptr;
+}
+#endif
+
+// Instrumentation policy of a VM (see IntcodeProfiler.cpp and
+// IntcodeTrace.cpp), its hooks are bound at compile time so this default one
+// compiles down to nothing. onOperands gets the values an instruction read
+// through its first two parameters, onFault is called before a fatal error.
+struct NoInstrumentation
+{
+  void onInstruction(size_t, DecodedInstruction) {}
+  void onOperands(IntCode, IntCode) {}
+  void onInputStarved(size_t) {}
+  void onMemoryGrowth(size_t) {}
+  void onMemoryWrite(size_t, IntCode, IntCode) {}
+  void onFault() {}
+};
+
+// Checking policy of a VM, what it verifies at run time. Checked addresses make
+// a negative address fatal, unchecked it wraps around to a far address.
+// Checked overflow makes any arithmetic result or relative base that does not
+// fit an IntCode fatal, unchecked it is whatever the hardware computes.
+template<bool Addresses, bool Overflow>
+struct IntcodeChecks
+{
+  static constexpr bool addresses = Addresses;
+  static constexpr bool overflow = Overflow;
+};
+using CheckedIntcode = IntcodeChecks<true, true>;
+using AddressCheckedIntcode = IntcodeChecks<true, false>;
+using UncheckedIntcode = IntcodeChecks<false, false>;
+
+// Immutable machine state that any number of VMs can be forked from
+template<typename VM>
+class BasicIntcodeSnapshot
+{
+public:
+  VM fork() const { return frozen->fork(); }
+
+private:
+  friend VM;
+  explicit BasicIntcodeSnapshot(shared_ptr<const VM> vm) : frozen(move(vm)) {}
+  shared_ptr<const VM> frozen;
+};
+
+template<typename VM> struct IntcodeInstructions;
+
+// Stateful Intcode machine, resume() and step() run in place so drivers can
+// feed inputs and read outputs between runs without copying the memory.
+// Copying a VM (fork) shares its memory pages copy-on-write.
+//
+// Memory cells may be narrower than IntCode: a program runs on them as long
+// as every value it stores fits, the first one that does not promotes the VM.
+// The run then goes on in a VM of the same kind with IntCode cells that this
+// one forwards to, inputs, outputs and the public accessors work the same.
+// Only IntCode cells checking addresses but not overflow get the native code,
+// JIT and loop tiers: they do not check more than that.
+template<typename Instrumentation = NoInstrumentation, typename Cell = IntCode, typename Checks = AddressCheckedIntcode>
+class BasicIntcodeVM
+{
+  static constexpr bool narrowCells = sizeof(Cell) < sizeof(IntCode);
+  static constexpr bool tiered = is_same_v<Instrumentation, NoInstrumentation> && is_same_v<Cell, IntCode> && Checks::addresses && !Checks::overflow;
+  // Split between both VMs, instrumentation counts would be wrong
+  static_assert(!narrowCells || is_same_v<Instrumentation, NoInstrumentation>, "narrow cells run uninstrumented");
+
+public:
+  using Snapshot = BasicIntcodeSnapshot<BasicIntcodeVM>;
+  using Memory = BasicIntcodeMemory<Cell>;
+  using WideVM = BasicIntcodeVM<Instrumentation, IntCode, Checks>;
+
+  queue<IntCode> inputs {};
+  vector<IntCode> outputs {};
+  bool terminated = false;
+  Instrumentation instrumentation {};
+
+
+  explicit BasicIntcodeVM(const vector<IntCode> &program, queue<IntCode> programInputs = {})
+    : inputs(move(programInputs)), memory(fits(program) ? Memory(program) : Memory()) {
+    if constexpr (tiered) {
+      native = findNativeIntcode(program);
+    }
+    if constexpr (narrowCells) {
+      if(!fits(program)) {
+        promotion.vm = make_unique<WideVM>(program);
+      }
+    }
+  }
+
+  explicit BasicIntcodeVM(Memory image, queue<IntCode> programInputs = {})
+    : inputs(move(programInputs)), memory(move(image)) {}
+
+  // Restored machine (see IntcodeCheckpoint.cpp)
+  BasicIntcodeVM(Memory image, size_t ip, IntCode rb, queue<IntCode> programInputs, bool isTerminated)
+    : inputs(move(programInputs)), terminated(isTerminated), memory(move(image)), instructionPointer(ip), relativeBase(rb) {}
+
+  explicit BasicIntcodeVM(const ProgramState &state)
+    : inputs(state.inputs), outputs(state.outputs), terminated(state.terminated),
+      memory(fits(state.memory) ? Memory(state.memory) : Memory()),
+      instructionPointer(state.instructionPointer), relativeBase(state.relativeBase) {
+    if constexpr (narrowCells) {
+      if(!fits(state.memory)) {
+        promotion.vm = make_unique<WideVM>(IntcodeMemory(state.memory), instructionPointer, relativeBase, queue<IntCode>(), terminated);
+      }
+    }
+  }
+
+  // Streaming alternatives to the inputs queue and outputs vector: the
+  // provider returns nullopt when it has nothing yet, the VM then waits
+  using InputProvider = function<optional<IntCode>()>;
+  using OutputSink = function<void(IntCode)>;
+  void setInputProvider(InputProvider provider) {
+    if constexpr (narrowCells) {
+      if(promotion.vm) promotion.vm->setInputProvider(provider);
+    }
+    inputProvider = move(provider);
+  }
+  void setOutputSink(OutputSink sink) {
+    if constexpr (narrowCells) {
+      if(promotion.vm) promotion.vm->setOutputSink(sink);
+    }
+    outputSink = move(sink);
+  }
+  // resume() also returns after that many outputs, 0 never pauses
+  void pauseAfterOutputs(size_t count) {
+    if constexpr (narrowCells) {
+      if(promotion.vm) promotion.vm->pauseAfterOutputs(count);
+    }
+    outputsBeforePause = count;
+  }
+
+  // Runs until the program halts or waits for an input
+  BasicIntcodeVM &resume() {
+    outputsSinceResume = 0;
+    return run();
+  }
+  // Executes a single instruction, false when halted or waiting for an input
+  bool step();
+
+  // Independent copy of this VM, memory pages are shared until written
+  BasicIntcodeVM fork() const { return *this; }
+  Snapshot snapshot() const { return Snapshot(make_shared<const BasicIntcodeVM>(*this)); }
+
+  bool waitingForInput() const { return !terminated && inputs.empty() && read(getInstructionPointer()) % 100 == 3; }
+  // True once a value did not fit the narrow cells
+  bool promoted() const {
+    if constexpr (narrowCells) {
+      return promotion.vm != nullptr;
+    }
+    return false;
+  }
+  size_t getInstructionPointer() const { return promoted() ? promotion.vm->getInstructionPointer() : instructionPointer; }
+  IntCode getRelativeBase() const { return promoted() ? promotion.vm->getRelativeBase() : relativeBase; }
+  // Memory of this VM itself, left empty by a promotion
+  const Memory &getMemory() const { return memory; }
+  IntCode read(size_t address) const { return promoted() ? promotion.vm->read(address) : memory.read(address); }
+  void write(size_t address, IntCode value) {
+    if constexpr (narrowCells) {
+      if(promotion.vm) {
+        promotion.vm->write(address, value);
+        return;
+      }
+      if(static_cast<Cell>(value) != value) {
+        promote(address, value);
+        return;
+      }
+    }
+    guardCompiledCode(address, value);
+    memory.write(address, static_cast<Cell>(value));
+    nativeChecked = false;
+  }
+  size_t jitCompiledBlocks() const {
+    return promoted() ? promotion.vm->jitCompiledBlocks() : jit.compiled ? jit.compiled->compiledBlocks() : 0;
+  }
+  uint64_t fastForwardedIterations() const {
+    return promoted() ? promotion.vm->fastForwardedIterations() : jit.compiled ? jit.compiled->fastForwarded : 0;
+  }
+  size_t residentBytes() const {
+    return sizeof(BasicIntcodeVM) + memory.residentBytes() + (promoted() ? promotion.vm->residentBytes() : 0);
+  }
+
+  ProgramState state() const {
+    if constexpr (narrowCells) {
+      if(promotion.vm) {
+        ProgramState s = promotion.vm->state();
+        s.inputs = inputs;
+        s.outputs = outputs;
+        return s;
+      }
+    }
+    ProgramState s;
+    s.memory = memory.toVector();
+    s.inputs = inputs;
+    s.outputs = outputs;
+    s.instructionPointer = instructionPointer;
+    s.relativeBase = relativeBase;
+    s.terminated = terminated;
+    return s;
+  }
+
+private:
+  friend struct IntcodeInstructions<BasicIntcodeVM>;
+  template<typename, typename, typename> friend class BasicIntcodeVM;
+
+  Memory memory;
+  size_t instructionPointer = 0;
+  IntCode relativeBase = 0;
+  InputProvider inputProvider {};
+  OutputSink outputSink {};
+  size_t outputsBeforePause = 0;
+  size_t outputsSinceResume = 0;
+  const IntcodeNativeProgram *native = nullptr;
+  bool nativeChecked = false;
+
+  // Forks start without compiled blocks, their code may diverge
+  struct JitSlot
+  {
+    unique_ptr<IntcodeJit> compiled {};
+    size_t interpretedBlocks = 0;
+    JitSlot() = default;
+    JitSlot(const JitSlot &) {}
+    JitSlot(JitSlot &&) = default;
+    JitSlot &operator=(const JitSlot &) { compiled.reset(); return *this; }
+    JitSlot &operator=(JitSlot &&) = default;
+  };
+  JitSlot jit {};
+
+  // VM a narrow one was promoted to, forks get their own copy of it
+  struct PromotionSlot
+  {
+    unique_ptr<WideVM> vm {};
+    PromotionSlot() = default;
+    PromotionSlot(const PromotionSlot &other) : vm(other.vm ? make_unique<WideVM>(*other.vm) : nullptr) {}
+    PromotionSlot(PromotionSlot &&) = default;
+    PromotionSlot &operator=(const PromotionSlot &other) {
+      vm = other.vm ? make_unique<WideVM>(*other.vm) : nullptr;
+      return *this;
+    }
+    PromotionSlot &operator=(PromotionSlot &&) = default;
+  };
+  struct NoPromotion { WideVM *vm = nullptr; };
+  conditional_t<narrowCells, PromotionSlot, NoPromotion> promotion {};
+
+  static bool fits(const vector<IntCode> &cells) {
+    return all_of(cells.cbegin(), cells.cend(), [](IntCode cell) { return static_cast<Cell>(cell) == cell; });
+  }
+
+  // Goes on with IntCode cells from the current state, the value that did not
+  // fit is written there
+  void promote(size_t address, IntCode value) {
+    promotion.vm = make_unique<WideVM>(IntcodeMemory(memory), instructionPointer, relativeBase, queue<IntCode>(), terminated);
+    WideVM &vm = *promotion.vm;
+    vm.inputProvider = inputProvider;
+    vm.outputSink = outputSink;
+    vm.outputsBeforePause = outputsBeforePause;
+    vm.write(address, value);
+    memory = Memory();
+  }
+
+  // Runs the promoted VM on the inputs queued here, its outputs and state are
+  // brought back
+  template<typename Run>
+  bool forward(Run run) {
+    WideVM &vm = *promotion.vm;
+    swap(vm.inputs, inputs);
+    vm.outputsSinceResume = outputsSinceResume;
+    const bool result = run(vm);
+    swap(vm.inputs, inputs);
+    outputs.insert(outputs.end(), vm.outputs.cbegin(), vm.outputs.cend());
+    vm.outputs.clear();
+    outputsSinceResume = vm.outputsSinceResume;
+    terminated = vm.terminated;
+    return result;
+  }
+
+  BasicIntcodeVM &run();
+
+  // Writes changing compiled code drop it: JIT blocks are compiled again, the
+  // native code never runs again
+  void guardCompiledCode(size_t address, IntCode value) {
+    if(jit.compiled && jit.compiled->guards(address) && memory.read(address) != value) {
+      jit.compiled->invalidate(address);
+    }
+    if(native && address < native->isCodeCell.size() && native->isCodeCell[address] && memory.read(address) != value) {
+      native = nullptr;
+    }
+  }
+
+  void runTiered();
+  bool interpretBlock();
+
+  // False when the native code stopped the run, true when the interpreter takes over
+  bool runNative() {
+    if(!nativeChecked) {
+      nativeChecked = true;
+      // The memory may have been patched through write() since it was loaded
+      for(const auto &[address, value] : native->codeCells) {
+        if(memory.read(address) != value) {
+          native = nullptr;
+          return true;
+        }
+      }
+    }
+    IntcodeNativeFrame frame {memory, *native, instructionPointer, relativeBase, this,
+      [](void *vm) { return static_cast<BasicIntcodeVM *>(vm)->nextInput(); },
+      [](void *vm, IntCode value) { return static_cast<BasicIntcodeVM *>(vm)->output(value); }};
+    const IntcodeNativeExit exit = native->run(frame);
+    instructionPointer = frame.instructionPointer;
+    relativeBase = frame.relativeBase;
+    if(frame.codeModified) {
+      native = nullptr;
+    }
+    if(exit == IntcodeNativeExit::Halted) {
+      terminated = true;
+    }
+    return exit == IntcodeNativeExit::Interpret;
+  }
+
+  optional<IntCode> nextInput() {
+    if(inputProvider) {
+      return inputProvider();
+    }
+    if(inputs.empty()) {
+      return nullopt;
+    }
+    const IntCode input = inputs.front();
+    inputs.pop();
+    return input;
+  }
+
+  // False when resume() should pause
+  bool output(IntCode value) {
+    if(outputSink) {
+      outputSink(value);
+    } else {
+      outputs.push_back(value);
+    }
+    return ++outputsSinceResume != outputsBeforePause;
+  }
+
+  // False when the value does not fit a narrow cell, the VM was promoted to
+  // write it
+  bool memWrite(size_t address, IntCode value) {
+    if constexpr (narrowCells) {
+      if(static_cast<Cell>(value) != value) {
+        promote(address, value);
+        return false;
+      }
+    }
+    // Only policies that watch writes pay for reading the previous value
+    if constexpr (!is_same_v<Instrumentation, NoInstrumentation>) {
+      instrumentation.onMemoryWrite(address, memory.read(address), value);
+    }
+    guardCompiledCode(address, value);
+    const size_t allocatedPages = memory.allocatedPages();
+    memory.write(address, static_cast<Cell>(value));
+    if(memory.allocatedPages() != allocatedPages) {
+      instrumentation.onMemoryGrowth(address);
+    }
+    return true;
+  }
+
+  IntCode memRead(size_t address) {
+    return memory.read(address);
+  }
+
+  template<int Mode>
+  size_t paramAddress(size_t paramNumber) {
+    const size_t paramPointer = instructionPointer + paramNumber;
+    IntCode address = Mode == ImmediateMode ? paramPointer : memRead(paramPointer);
+    if(Mode == RelativeMode) {
+      address += relativeBase;
+    }
+    if constexpr (Checks::addresses) {
       if (address < 0) {
-        cerr << "Illegal program memory access: negative address\n";
+        cerr << "Illegal program memory access: negative address at position: " << instructionPointer << "\n";
+        instrumentation.onFault();
         throw;
       }
-      return address;
-    };
+    }
+    return address;
+  }
 
-    const auto getParamValue = [&](size_t paramNumber){;
-      return memRead(getParamValueAdress(paramNumber));
-    };
+  // Sum (Code 1) or product (Code 2)
+  template<int Code>
+  IntCode arithmetic(IntCode op1, IntCode op2) {
+    IntCode result;
+    if constexpr (Checks::overflow) {
+      if(Code == 1 ? __builtin_add_overflow(op1, op2, &result) : __builtin_mul_overflow(op1, op2, &result)) {
+        cerr << "Illegal program arithmetic: overflow at position: " << instructionPointer << "\n";
+        instrumentation.onFault();
+        throw;
+      }
+    } else {
+      result = Code == 1 ? op1 + op2 : op1 * op2;
+    }
+    return result;
+  }
+
+  template<int Mode>
+  IntCode param(size_t paramNumber) {
+    return memRead(paramAddress<Mode>(paramNumber));
+  }
+};
 
-    if(code == 1 || code == 2) { // * & +
-      const IntCode op1 = getParamValue(1);
-      const IntCode op2 = getParamValue(2);
-      const IntCode dest = getParamValueAdress(3);
-      memWrite(dest, code == 1 ? op1 + op2 : op1 * op2);
-      state.instructionPointer += 4;
-    }
-    else if (code == 3) { // input
-      if(state.inputs.empty()) {
-        return state;
-      }
-      const IntCode input = state.inputs.front();
-      state.inputs.pop();
-      const IntCode dest = getParamValueAdress(1);
-      memWrite(dest, input);
-      state.instructionPointer += 2;
-    }
-    else if (code == 4) { // output
-      const IntCode value = getParamValue(1);
-      state.outputs.push_back(value);
-      state.instructionPointer += 2;
-    }
-    else if (code == 5 || code == 6) { // jump if true & jump if false
-      const IntCode op1 = getParamValue(1);
-      if((code == 5 && op1 != 0) || (code == 6 && op1 == 0)) {
-        const IntCode op2 = getParamValue(2);
-        state.instructionPointer = op2;
+// Handlers return false when the program stops, either halted or waiting for input
+template<typename VM>
+struct IntcodeInstructions
+{
+  using Handler = bool (*)(VM &);
+
+  template<int Code, int Mode1, int Mode2, int Mode3>
+  static bool execute(VM &vm) {
+    if constexpr (Code != 3) {
+      vm.instrumentation.onInstruction(vm.instructionPointer, Code * 27 + Mode1 + Mode2 * 3 + Mode3 * 9);
+    }
+    if constexpr (Code == 1 || Code == 2) { // + & *
+      const IntCode op1 = vm.template param<Mode1>(1);
+      const IntCode op2 = vm.template param<Mode2>(2);
+      vm.instrumentation.onOperands(op1, op2);
+      const IntCode result = vm.template arithmetic<Code>(op1, op2);
+      const size_t address = vm.template paramAddress<Mode3>(3);
+      vm.instructionPointer += 4;
+      return vm.memWrite(address, result);
+    }
+    else if constexpr (Code == 3) { // input
+      const optional<IntCode> input = vm.nextInput();
+      if(!input.has_value()) {
+        vm.instrumentation.onInputStarved(vm.instructionPointer);
+        return false;
+      }
+      vm.instrumentation.onInstruction(vm.instructionPointer, Code * 27 + Mode1 + Mode2 * 3 + Mode3 * 9);
+      const size_t address = vm.template paramAddress<Mode1>(1);
+      vm.instructionPointer += 2;
+      return vm.memWrite(address, input.value());
+    }
+    else if constexpr (Code == 4) { // output
+      const IntCode value = vm.template param<Mode1>(1);
+      vm.instrumentation.onOperands(value, 0);
+      vm.instructionPointer += 2;
+      return vm.output(value);
+    }
+    else if constexpr (Code == 5 || Code == 6) { // jump if true & jump if false
+      const IntCode op1 = vm.template param<Mode1>(1);
+      if((Code == 5) == (op1 != 0)) {
+        const IntCode target = vm.template param<Mode2>(2);
+        vm.instrumentation.onOperands(op1, target);
+        vm.instructionPointer = target;
       } else {
-        state.instructionPointer += 3;
+        vm.instrumentation.onOperands(op1, 0);
+        vm.instructionPointer += 3;
       }
     }
-    else if (code == 7 || code == 8) { // less than & equals
-      const IntCode op1 = getParamValue(1);
-      const IntCode op2 = getParamValue(2);
-      const IntCode dest = getParamValueAdress(3);
-      memWrite(dest, (code == 7 && op1 < op2) ? 1 : ((code == 8 && op1 == op2) ? 1 : 0));
-      state.instructionPointer += 4;
+    else if constexpr (Code == 7 || Code == 8) { // less than & equals
+      const IntCode op1 = vm.template param<Mode1>(1);
+      const IntCode op2 = vm.template param<Mode2>(2);
+      vm.instrumentation.onOperands(op1, op2);
+      const size_t address = vm.template paramAddress<Mode3>(3);
+      vm.instructionPointer += 4;
+      return vm.memWrite(address, (Code == 7 ? op1 < op2 : op1 == op2) ? 1 : 0);
     }
-    else if (code == 9) { // adjusts relative base
-      const IntCode value = getParamValue(1);
-      state.relativeBase += value;
-      state.instructionPointer += 2;
+    else if constexpr (Code == 9) { // adjusts relative base
+      const IntCode offset = vm.template param<Mode1>(1);
+      vm.instrumentation.onOperands(offset, 0);
+      vm.relativeBase = vm.template arithmetic<1>(vm.relativeBase, offset);
+      vm.instructionPointer += 2;
     }
-    else if (code == 99) {
-      run = false;
+    return true;
+  }
+
+  static bool halt(VM &vm) {
+    vm.instrumentation.onInstruction(vm.instructionPointer, haltInstruction);
+    vm.terminated = true;
+    return false;
+  }
+
+  static bool invalid(VM &vm) {
+    cerr << "opCode not supported: " << vm.read(vm.instructionPointer) % 100 << " at position: " << vm.instructionPointer << "\n";
+    vm.instrumentation.onFault();
+    throw;
+  }
+
+  static bool decodeAndExecute(VM &vm);
+};
+
+template<typename VM, size_t Index>
+constexpr typename IntcodeInstructions<VM>::Handler instructionHandler() {
+  using Instructions = IntcodeInstructions<VM>;
+  constexpr int code = Index / 27;
+  if constexpr (Index == notDecoded) return &Instructions::decodeAndExecute;
+  else if constexpr (Index == haltInstruction) return &Instructions::halt;
+  else if constexpr (code >= 1 && code <= 9) return &Instructions::template execute<code, Index % 3, Index / 3 % 3, Index / 9 % 3>;
+  else return &Instructions::invalid;
+}
+
+template<typename VM, size_t... Indexes>
+constexpr array<typename IntcodeInstructions<VM>::Handler, sizeof...(Indexes)> makeInstructionTable(index_sequence<Indexes...>) {
+  return {instructionHandler<VM, Indexes>()...};
+}
+
+template<typename VM>
+constexpr auto instructionTable = makeInstructionTable<VM>(make_index_sequence<instructionTableSize>{});
+
+template<typename VM>
+bool IntcodeInstructions<VM>::decodeAndExecute(VM &vm) {
+  const size_t ip = vm.instructionPointer;
+  const DecodedInstruction instruction = decodeInstruction(vm.memory.read(ip));
+  vm.memory.cacheDecoded(ip, instruction);
+  return instructionTable<VM>[instruction](vm);
+}
+
+template<typename Instrumentation, typename Cell, typename Checks>
+bool BasicIntcodeVM<Instrumentation, Cell, Checks>::step() {
+  if constexpr (narrowCells) {
+    if(promotion.vm) {
+      return forward([](WideVM &vm) { return vm.step(); });
     }
-    else {
-      cerr << "opCode not supported: " << code << " at position: " << state.instructionPointer << "\n";
-      cerr << initialState.memory << "\n";
-      cerr << state.memory << "\n";
-      throw;
+  }
+  if(terminated) {
+    return false;
+  }
+  // An instruction promoting the VM was executed, the program goes on
+  return instructionTable<BasicIntcodeVM>[memory.decoded(instructionPointer)](*this) || promoted();
+}
+
+template<typename Instrumentation, typename Cell, typename Checks>
+BasicIntcodeVM<Instrumentation, Cell, Checks> &BasicIntcodeVM<Instrumentation, Cell, Checks>::run() {
+  if constexpr (narrowCells) {
+    if(promotion.vm) {
+      forward([](WideVM &vm) { vm.run(); return true; });
+      return *this;
+    }
+  }
+  // Native code only runs uninstrumented, and the JIT only without native code
+  if constexpr (tiered) {
+    if(native && !terminated && !runNative()) {
+      return *this;
+    }
+    if(!native && (intcodeTiers.jit || intcodeTiers.loops)) {
+      runTiered();
+      return *this;
+    }
+  }
+  while(step()) {
+    // Promoted by the last instruction, the run goes on from there
+    if constexpr (narrowCells) {
+      if(promotion.vm) {
+        return run();
+      }
+    }
+  }
+  return *this;
+}
+
+template<typename Instrumentation, typename Cell, typename Checks>
+void BasicIntcodeVM<Instrumentation, Cell, Checks>::runTiered() {
+  // Short runs stay interpreted, blocks are only counted after a warm up
+  while(!jit.compiled) {
+    if(jit.interpretedBlocks >= intcodeTiers.jitWarmUp) {
+      jit.compiled = make_unique<IntcodeJit>(intcodeTiers);
+    } else if(terminated || !interpretBlock()) {
+      return;
+    } else {
+      jit.interpretedBlocks++;
     }
   }
-  state.terminated = true;
-  return state;
+  IntcodeJit &compiled = *jit.compiled;
+  IntcodeJitContext context {nullptr, 0, 0, &memory, &compiled, false};
+  while(!terminated) {
+    const IntcodeAffineLoop *loop = compiled.loopAt(instructionPointer);
+    const auto exit = loop ? loop->exitState(memory, relativeBase) : nullopt;
+    if(exit) {
+      for(const auto &[address, value] : exit->first) {
+        memWrite(address, value);
+      }
+      instructionPointer = loop->end;
+      compiled.fastForwarded += exit->second;
+    } else if(const IntcodeJit::BlockCode block = compiled.blockAt(instructionPointer)) {
+      context.densePages = memory.densePageTable();
+      context.densePageCount = memory.densePageCount();
+      context.relativeBase = relativeBase;
+      instructionPointer = block(&context);
+      relativeBase = context.relativeBase;
+      if(context.faulted) {
+        step();
+        context.faulted = false;
+      }
+    } else if(!interpretBlock()) {
+      return;
+    }
+    compiled.enter(memory, instructionPointer);
+  }
+}
+
+// Interprets up to the end of the basic block: inputs, outputs and jumps end
+// it. False when the program stopped.
+template<typename Instrumentation, typename Cell, typename Checks>
+bool BasicIntcodeVM<Instrumentation, Cell, Checks>::interpretBlock() {
+  DecodedInstruction decoded;
+  do {
+    decoded = memory.decoded(instructionPointer);
+    if(decoded == notDecoded) {
+      decoded = decodeInstruction(memory.read(instructionPointer));
+      memory.cacheDecoded(instructionPointer, decoded);
+    }
+    if(!instructionTable<BasicIntcodeVM>[decoded](*this)) {
+      return false;
+    }
+  } while(decoded < 3 * 27 || decoded >= 7 * 27);
+  return true;
+}
+
+using IntcodeVM = BasicIntcodeVM<>;
+using IntcodeSnapshot = IntcodeVM::Snapshot;
+// Other engines to pick per workload (see intcode-bench.cpp): every error
+// reported, nothing checked, and 32 bit cells
+using CheckedIntcodeVM = BasicIntcodeVM<NoInstrumentation, IntCode, CheckedIntcode>;
+using UncheckedIntcodeVM = BasicIntcodeVM<NoInstrumentation, IntCode, UncheckedIntcode>;
+using NarrowIntcodeVM = BasicIntcodeVM<NoInstrumentation, int32_t>;
+
+template<typename VM = IntcodeVM>
+ProgramState runProgram(const ProgramState initialState) {
+  return VM(initialState).resume().state();
 }
 
 // Signature backward compatibility
-ProgramState runProgram(const vector<IntCode> program, queue<IntCode> inputs = {}) {
-  ProgramState initialState;
-  initialState.memory = program;
-  initialState.inputs = inputs;
-  return runProgram(initialState);
+template<typename VM = IntcodeVM>
+ProgramState runProgram(const vector<IntCode> &program, queue<IntCode> inputs = {}) {
+  return VM(program, move(inputs)).resume().state();
 };
 
+// Single pass over the text, strtoll skips the blanks around each value
 vector<IntCode> parseIntcode(const string str) {
-  const vector<string> opCodes = split(str, ",");
   vector<IntCode> program;
-  for(auto oc : opCodes) {
-    program.push_back(stoll(oc));
+  program.reserve(count(str.cbegin(), str.cend(), ',') + 1);
+  const char *cursor = str.c_str();
+  while(true) {
+    char *end;
+    program.push_back(strtoll(cursor, &end, 10));
+    if(end == cursor) {
+      cerr << "Invalid Intcode program at offset " << cursor - str.c_str() << "\n";
+      throw;
+    }
+    cursor = end + strspn(end, " \t\r\n");
+    if(*cursor != ',') {
+      return program;
+    }
+    cursor++;
   }
-  return program;
 }
 
 // Convenient signature for testing
-ProgramState runProgram(string program, queue<IntCode> inputs = {}) {
-  return runProgram(parseIntcode(program), inputs);
+template<typename VM = IntcodeVM>
+ProgramState runProgram(const string &program, queue<IntCode> inputs = {}) {
+  return runProgram<VM>(parseIntcode(program), move(inputs));
 }
 
-void testComputer() {
-  cout << "Intcode Computer test begin\n";
-
+template<typename VM>
+void testComputerPrograms() {
   // Day 2 tests, opcode 1, 2 & 99
-  assert(runProgram("1,0,0,0,99").memory == parseIntcode("2,0,0,0,99"));
-  assert(runProgram("2,3,0,3,99").memory == parseIntcode("2,3,0,6,99"));
-  assert(runProgram("2,4,4,5,99,0").memory == parseIntcode("2,4,4,5,99,9801"));
-  assert(runProgram("1,1,1,4,99,5,6,0,99").memory == parseIntcode("30,1,1,4,2,5,6,0,99"));
-  assert(runProgram("1,9,10,3,2,3,11,0,99,30,40,50").memory == parseIntcode("3500,9,10,70, 2,3,11,0, 99, 30,40,50"));
+  assert(runProgram<VM>("1,0,0,0,99").memory == parseIntcode("2,0,0,0,99"));
+  assert(runProgram<VM>("2,3,0,3,99").memory == parseIntcode("2,3,0,6,99"));
+  assert(runProgram<VM>("2,4,4,5,99,0").memory == parseIntcode("2,4,4,5,99,9801"));
+  assert(runProgram<VM>("1,1,1,4,99,5,6,0,99").memory == parseIntcode("30,1,1,4,2,5,6,0,99"));
+  assert(runProgram<VM>("1,9,10,3,2,3,11,0,99,30,40,50").memory == parseIntcode("3500,9,10,70, 2,3,11,0, 99, 30,40,50"));
 
   // Day 5 part 1 tests, opcode 3, 4 & immediate mode
   queue<IntCode> testInput({42, 551});
-  assert(runProgram("3,0,4,0,99", testInput).outputs.front() == 42);
-  assert(runProgram("3,0,4,0,3,1,4,1,99", testInput).outputs == parseIntcode("42, 551"));
+  assert(runProgram<VM>("3,0,4,0,99", testInput).outputs.front() == 42);
+  assert(runProgram<VM>("3,0,4,0,3,1,4,1,99", testInput).outputs == parseIntcode("42, 551"));
 
-  assert(runProgram("1002,4,3,4,33").memory == parseIntcode("1002,4,3,4,99"));
+  assert(runProgram<VM>("1002,4,3,4,33").memory == parseIntcode("1002,4,3,4,99"));
 
   // Day 5 part 2 tests, opcode 5, 6, 7, 8
   queue<IntCode> inputIsZero({0});
@@ -177,45 +1648,194 @@ void testComputer() {
 
   const auto equalsEight_p = "3,9,8,9,10,9,4,9,99,-1,8";
   const auto equalsEight_i = "3,3,1108,-1,8,3,4,3,99";
-  assert(runProgram(equalsEight_p, inputIsEight).outputs.front() == 1);
-  assert(runProgram(equalsEight_i, inputIsEight).outputs.front() == 1);
-  assert(runProgram(equalsEight_p, inputIsLessThanEight).outputs.front() == 0);
-  assert(runProgram(equalsEight_i, inputIsLessThanEight).outputs.front() == 0);
+  assert(runProgram<VM>(equalsEight_p, inputIsEight).outputs.front() == 1);
+  assert(runProgram<VM>(equalsEight_i, inputIsEight).outputs.front() == 1);
+  assert(runProgram<VM>(equalsEight_p, inputIsLessThanEight).outputs.front() == 0);
+  assert(runProgram<VM>(equalsEight_i, inputIsLessThanEight).outputs.front() == 0);
 
   const auto lessThanEight_p = "3,9,7,9,10,9,4,9,99,-1,8";
   const auto lessThanEight_i = "3,3,1107,-1,8,3,4,3,99";
-  assert(runProgram(lessThanEight_p, inputIsLessThanEight).outputs.front() == 1);
-  assert(runProgram(lessThanEight_i, inputIsLessThanEight).outputs.front() == 1);
-  assert(runProgram(lessThanEight_p, inputIsEight).outputs.front() == 0);
-  assert(runProgram(lessThanEight_i, inputIsEight).outputs.front() == 0);
+  assert(runProgram<VM>(lessThanEight_p, inputIsLessThanEight).outputs.front() == 1);
+  assert(runProgram<VM>(lessThanEight_i, inputIsLessThanEight).outputs.front() == 1);
+  assert(runProgram<VM>(lessThanEight_p, inputIsEight).outputs.front() == 0);
+  assert(runProgram<VM>(lessThanEight_i, inputIsEight).outputs.front() == 0);
 
   const auto isNotZero_p = "3,12,6,12,15,1,13,14,13,4,13,99,-1,0,1,9";
   const auto isNotZero_i = "3,3,1105,-1,9,1101,0,0,12,4,12,99,1";
-  assert(runProgram(isNotZero_p, inputIsEight).outputs.front() == 1);
-  assert(runProgram(isNotZero_i, inputIsEight).outputs.front() == 1);
-  assert(runProgram(isNotZero_p, inputIsZero).outputs.front() == 0);
-  assert(runProgram(isNotZero_i, inputIsZero).outputs.front() == 0);
+  assert(runProgram<VM>(isNotZero_p, inputIsEight).outputs.front() == 1);
+  assert(runProgram<VM>(isNotZero_i, inputIsEight).outputs.front() == 1);
+  assert(runProgram<VM>(isNotZero_p, inputIsZero).outputs.front() == 0);
+  assert(runProgram<VM>(isNotZero_i, inputIsZero).outputs.front() == 0);
 
   const auto compareToEight = "3,21,1008,21,8,20,1005,20,22,107,8,21,20,1006,20,31,1106,0,36,98,0,0,1002,21,125,20,4,20,1105,1,46,104,999,1105,1,46,1101,1000,1,20,4,20,1105,1,46,98,99";
-  assert(runProgram(compareToEight, inputIsMoreThanEight).outputs.front() == 1001);
-  assert(runProgram(compareToEight, inputIsEight).outputs.front() == 1000);
-  assert(runProgram(compareToEight, inputIsLessThanEight).outputs.front() == 999);
+  assert(runProgram<VM>(compareToEight, inputIsMoreThanEight).outputs.front() == 1001);
+  assert(runProgram<VM>(compareToEight, inputIsEight).outputs.front() == 1000);
+  assert(runProgram<VM>(compareToEight, inputIsLessThanEight).outputs.front() == 999);
 
   // Day 7 part 2 tests, halt when waiting for input
-  assert(runProgram(compareToEight, inputIsLessThanEight).terminated == true);
+  assert(runProgram<VM>(compareToEight, inputIsLessThanEight).terminated == true);
 
   queue<IntCode> emptyInput {};
-  auto haltedState = runProgram(compareToEight, emptyInput);
+  auto haltedState = runProgram<VM>(compareToEight, emptyInput);
   assert(haltedState.terminated == false);
   haltedState.inputs.push(8);
-  assert(runProgram(haltedState).terminated == true);
-  assert(runProgram(haltedState).outputs.front() == 1000);
+  assert(runProgram<VM>(haltedState).terminated == true);
+  assert(runProgram<VM>(haltedState).outputs.front() == 1000);
+
+  // Resuming a VM runs in place, the memory is never copied
+  VM haltedVM(parseIntcode(compareToEight));
+  assert(!haltedVM.resume().terminated && haltedVM.waitingForInput());
+  const size_t allocationsBeforeResume = intcodeMemoryAllocations;
+  haltedVM.inputs.push(8);
+  assert(haltedVM.step());
+  assert(haltedVM.resume().terminated);
+  assert(haltedVM.outputs.front() == 1000);
+  assert(!haltedVM.step());
+  assert(intcodeMemoryAllocations == allocationsBeforeResume);
+
+  // Forks share memory pages until one of them writes to a page
+  VM warmedUp(parseIntcode(compareToEight));
+  const auto waitingForInput = warmedUp.resume().snapshot();
+  const size_t allocationsBeforeFork = intcodeMemoryAllocations;
+  auto forkLessThanEight = waitingForInput.fork();
+  auto forkMoreThanEight = waitingForInput.fork();
+  assert(intcodeMemoryAllocations == allocationsBeforeFork);
+  forkLessThanEight.inputs.push(3);
+  forkMoreThanEight.inputs.push(4847);
+  assert(forkLessThanEight.resume().outputs.front() == 999);
+  assert(forkMoreThanEight.resume().outputs.front() == 1001);
+  assert(intcodeMemoryAllocations == allocationsBeforeFork + 2);
+  assert(waitingForInput.fork().resume().waitingForInput());
+
+  // Far addresses cost a single page, untouched memory reads as zero without allocating
+  VM farMemory(parseIntcode("1101,7,35,1000000000,4,1000000000,4,123456789,99"));
+  const size_t allocationsBeforeFarWrite = intcodeMemoryAllocations;
+  assert(farMemory.resume().outputs == parseIntcode("42,0"));
+  assert(intcodeMemoryAllocations == allocationsBeforeFarWrite + 1);
+  IntcodeMemory gapped;
+  gapped.write(2000, 99);
+  gapped.cacheDecoded(600, invalidInstruction);
+  assert(gapped.decoded(600) == notDecoded && zeroMemoryPage<IntCode>()->decoded[600 & memoryPageMask] == notDecoded);
 
   // Day 9 test, relative mode, opcode 9
   const auto replicatingProgram = parseIntcode("109,1,204,-1,1001,100,1,100,1008,100,16,101,1006,101,0,99");
-  assert(runProgram(replicatingProgram).outputs == replicatingProgram);
-  assert(to_string(runProgram("1102,34915192,34915192,7,4,7,99,0").outputs.back()).size() == 16);
-  assert(runProgram("104,1125899906842624,99").outputs.back() == 1125899906842624);
+  assert(runProgram<VM>(replicatingProgram).outputs == replicatingProgram);
+  assert(to_string(runProgram<VM>("1102,34915192,34915192,7,4,7,99,0").outputs.back()).size() == 16);
+  assert(runProgram<VM>("104,1125899906842624,99").outputs.back() == 1125899906842624);
+
+  // Streaming inputs and outputs, optionally pausing after a number of outputs
+  VM streamed(replicatingProgram);
+  vector<IntCode> sunk;
+  streamed.setOutputSink([&](IntCode value) { sunk.push_back(value); });
+  streamed.pauseAfterOutputs(2);
+  assert(!streamed.resume().terminated && sunk.size() == 2 && streamed.outputs.empty());
+  streamed.pauseAfterOutputs(0);
+  assert(streamed.resume().terminated && sunk == replicatingProgram);
+
+  VM provided(parseIntcode(compareToEight));
+  provided.setInputProvider([]() { return optional<IntCode>(8); });
+  assert(provided.resume().outputs.front() == 1000);
+
+  // Loop patching the increment of its own body once the counter reaches 5
+  const auto selfModifying = parseIntcode("1101,0,0,100,1001,100,1,100,1008,100,5,101,1006,101,19,1101,0,10,6,1007,100,100,101,1005,101,4,4,100,99");
+  assert(runProgram<VM>(selfModifying).outputs == parseIntcode("105"));
+  VM countTo1000(parseIntcode("1101,0,0,100,1001,100,1,100,1007,100,1000,101,1005,101,4,4,100,99"));
+  assert(countTo1000.resume().outputs == parseIntcode("1000"));
+#if defined(__x86_64__) && defined(__linux__)
+  assert(!intcodeTiers.jit || countTo1000.jitCompiledBlocks() > 0);
+#endif
+  assert(!intcodeTiers.loops || countTo1000.fastForwardedIterations() > 990);
+
+  // Counting loops: stepping by a cell and comparing before the step, then
+  // counting down in relative mode to zero. Fast-forwarded, the countdown
+  // runs for 250 billion iterations.
+  assert(runProgram<VM>("1101,0,7,100,1101,0,3,102,1008,100,37,101,1,100,102,100,1006,101,8,4,100,99").outputs == parseIntcode("40"));
+  const auto countDown = [](const string &from) {
+    return parseIntcode("109,50,21101,0," + from + ",0,21201,0,-4,0,1205,0,6,204,0,4,51,99");
+  };
+  assert(runProgram<VM>(countDown("4000")).outputs == parseIntcode("0,0"));
+  if(intcodeTiers.loops) {
+    VM longCountDown(countDown("1000000000000"));
+    assert(longCountDown.resume().outputs == parseIntcode("0,0"));
+    assert(longCountDown.fastForwardedIterations() > 249999999000);
+  }
+  // Doubling is not affine, the loop runs as it is
+  assert(runProgram<VM>("1101,0,1,100,1,100,100,100,1007,100,1000,101,1005,101,4,4,100,99").outputs == parseIntcode("1024"));
+}
+
+void testComputer() {
+  cout << "Intcode Computer test begin\n";
+
+  // Every test runs interpreted on each engine, then with the JIT compiling
+  // blocks and fast-forwarding loops from their first entry
+  const IntcodeTierSettings tiers = intcodeTiers;
+  intcodeTiers = {false, 0, 0, false};
+  testComputerPrograms<IntcodeVM>();
+  testComputerPrograms<CheckedIntcodeVM>();
+  testComputerPrograms<UncheckedIntcodeVM>();
+  testComputerPrograms<NarrowIntcodeVM>();
+  intcodeTiers = {true, 1, 0, true};
+  testComputerPrograms<IntcodeVM>();
+  intcodeTiers = tiers;
+
+  // A loop found not affine is turned down without being analysed again
+  const IntcodeMemory doubling(parseIntcode("1101,0,1,100,1,100,100,100,1007,100,1000,101,1005,101,4,4,100,99"));
+  const auto doublingLoop = findAffineLoop(doubling, 4);
+  assert(doublingLoop && !doublingLoop->exitState(doubling, 0) && doublingLoop->rejectedRelativeBase == 0);
+
+  // Narrow cells are promoted by the first value that does not fit them, be it
+  // computed or an input, and the run goes on where it was
+  const auto scaleInputs = parseIntcode("3,100,1002,100,1000000,100,4,100,1105,1,0");
+  NarrowIntcodeVM narrow(scaleInputs);
+  narrow.inputs.push(3);
+  assert(narrow.resume().waitingForInput() && !narrow.promoted());
+  const auto beforePromotion = narrow.snapshot();
+  narrow.inputs.push(5000);
+  narrow.inputs.push(2);
+  assert(narrow.resume().waitingForInput() && narrow.promoted());
+  assert(narrow.outputs == parseIntcode("3000000,5000000000,2000000") && narrow.read(100) == 2000000);
+  auto promotedByInput = beforePromotion.fork();
+  promotedByInput.inputs.push(1099511627776);
+  assert(promotedByInput.resume().outputs == parseIntcode("3000000,1099511627776000000") && promotedByInput.promoted());
+  assert(!beforePromotion.fork().promoted());
+  assert(NarrowIntcodeVM(parseIntcode("104,1125899906842624,99")).promoted());
+
+  // Native code hands over to the interpreter at 10, which patches the
+  // compiled output instruction at 5 before waiting for input again: the next
+  // resume must not run the native code, it would output [101]
+  vector<IntCode> patchingImage = parseIntcode("3,100,1005,100,10,4,101,1105,1,0,1101,0,102,6,1105,1,0");
+  patchingImage.resize(103);
+  patchingImage[101] = 11;
+  patchingImage[102] = 22;
+  static IntcodeNativeProgram patchedByInterpreter {hashIntcode(patchingImage), patchingImage.size(), [](IntcodeNativeFrame &f) {
+    for(size_t pc = f.instructionPointer;; pc = 0) {
+      switch(pc) {
+        case 0: {
+          const optional<IntCode> in = f.input(f.vm);
+          if(!in) return f.exit(IntcodeNativeExit::Paused, 0, f.relativeBase);
+          f.write(100, *in);
+          if(f.read(100) != 0) return f.exit(IntcodeNativeExit::Interpret, 10, f.relativeBase);
+        }
+        [[fallthrough]];
+        case 5:
+          if(!f.output(f.vm, f.read(101))) return f.exit(IntcodeNativeExit::Paused, 7, f.relativeBase);
+          [[fallthrough]];
+        case 7:
+          break;
+        default:
+          return f.exit(IntcodeNativeExit::Interpret, pc, f.relativeBase);
+      }
+    }
+  }, {{0, 3}, {1, 100}, {2, 1005}, {3, 100}, {4, 10}, {5, 4}, {6, 101}, {7, 1105}, {8, 1}, {9, 0}}};
+  // Registered once, however many times the test runs
+  [[maybe_unused]] static const bool patchedRegistered = registerNativeIntcode(patchedByInterpreter);
+  IntcodeVM patched(patchingImage);
+  patched.inputs.push(1);
+  patched.resume();
+  assert(patched.waitingForInput() && patched.outputs.empty() && patched.read(6) == 102);
+  patched.inputs.push(0);
+  patched.resume();
+  assert(patched.outputs == parseIntcode("22"));
 
   cout << "Intcode Computer test successful\n\n";
 }
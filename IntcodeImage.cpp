@@ -0,0 +1,164 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "IntcodeComputer.cpp"
+
+// Compiled Intcode image: a fixed header followed by the cells as little-endian
+// int64, so loading a program maps the file instead of parsing its text.
+// Header fields are little-endian too.
+constexpr char intcodeImageMagic[8] = {'I', 'N', 'T', 'C', 'O', 'D', 'E', '1'};
+struct IntcodeImageHeader
+{
+  char magic[8];
+  uint64_t cellCount;
+  uint64_t hash; // hashIntcode of the cells
+  uint64_t reserved;
+};
+static_assert(sizeof(IntcodeImageHeader) % sizeof(IntCode) == 0, "cells must stay aligned after the header");
+
+bool littleEndianHost() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t *>(&probe) == 1;
+}
+
+void writeLittleEndian(ostream &os, uint64_t value) {
+  char bytes[8];
+  for(size_t i = 0; i < 8; i++, value >>= 8) {
+    bytes[i] = static_cast<char>(value & 0xff);
+  }
+  os.write(bytes, 8);
+}
+
+uint64_t readLittleEndian(const uint8_t *bytes) {
+  uint64_t value = 0;
+  for(size_t i = 8; i-- > 0;) {
+    value = value << 8 | bytes[i];
+  }
+  return value;
+}
+
+void writeIntcodeImage(const vector<IntCode> &program, const string &imagePath) {
+  ofstream image(imagePath, ios::binary | ios::trunc);
+  image.write(intcodeImageMagic, sizeof(intcodeImageMagic));
+  writeLittleEndian(image, program.size());
+  writeLittleEndian(image, hashIntcode(program));
+  writeLittleEndian(image, 0);
+  for(const IntCode cell : program) {
+    writeLittleEndian(image, static_cast<uint64_t>(cell));
+  }
+  if(!image) {
+    cerr << "Cannot write Intcode image " << imagePath << "\n";
+    throw;
+  }
+}
+
+// Converts the text form of a puzzle input to an image
+void compileIntcodeImage(const string &textPath, const string &imagePath) {
+  const auto lines = getPuzzleInput(textPath);
+  if(lines.empty()) {
+    cerr << "Cannot read Intcode program " << textPath << "\n";
+    throw;
+  }
+  writeIntcodeImage(parseIntcode(lines.front()), imagePath);
+}
+
+// Loaded image, memory can be handed to as many VMs as needed: they all share
+// the mapping copy-on-write like forks do
+struct IntcodeImage
+{
+  IntcodeMemory memory;
+  uint64_t hash;
+  size_t cellCount;
+};
+
+// Maps an image privately: the file is never modified, a page written by a VM
+// is copied, by the VM when the page is shared and by the kernel otherwise.
+// Mapping is O(1) in the program size apart from the page table.
+// The hash is not checked here, see verifyIntcodeImage.
+IntcodeImage mapIntcodeImage(const string &imagePath) {
+  const int fd = open(imagePath.c_str(), O_RDONLY);
+  struct stat info;
+  if(fd < 0 || fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(IntcodeImageHeader)) {
+    cerr << "Cannot open Intcode image " << imagePath << "\n";
+    throw;
+  }
+  const size_t length = info.st_size;
+  void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED) {
+    cerr << "Cannot map Intcode image " << imagePath << "\n";
+    throw;
+  }
+  shared_ptr<void> mapping(mapped, [length](void *p) { munmap(p, length); });
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(mapped);
+  const uint64_t cellCount = readLittleEndian(bytes + 8);
+  const uint64_t hash = readLittleEndian(bytes + 16);
+  if(memcmp(bytes, intcodeImageMagic, sizeof(intcodeImageMagic)) != 0
+    || cellCount > (length - sizeof(IntcodeImageHeader)) / sizeof(IntCode)) {
+    cerr << "Invalid Intcode image " << imagePath << "\n";
+    throw;
+  }
+
+  IntCode *cells = reinterpret_cast<IntCode *>(static_cast<uint8_t *>(mapped) + sizeof(IntcodeImageHeader));
+  if(littleEndianHost()) {
+    return {IntcodeMemory(cells, cellCount, move(mapping)), hash, cellCount};
+  }
+  // Big-endian hosts decode the cells into ordinary pages instead
+  vector<IntCode> program(cellCount);
+  for(size_t i = 0; i < cellCount; i++) {
+    program[i] = static_cast<IntCode>(readLittleEndian(reinterpret_cast<const uint8_t *>(cells + i)));
+  }
+  return {IntcodeMemory(program), hash, cellCount};
+}
+
+bool verifyIntcodeImage(const IntcodeImage &image) {
+  vector<IntCode> cells(image.cellCount);
+  for(size_t address = 0; address < image.cellCount; address++) {
+    cells[address] = image.memory.read(address);
+  }
+  return hashIntcode(cells) == image.hash;
+}
+
+// Program memory from either form: compiled images are mapped, text is parsed
+IntcodeMemory loadIntcodeMemory(const string &path) {
+  ifstream file(path, ios::binary);
+  char magic[sizeof(intcodeImageMagic)] = {};
+  file.read(magic, sizeof(magic));
+  if(file && memcmp(magic, intcodeImageMagic, sizeof(magic)) == 0) {
+    return mapIntcodeImage(path).memory;
+  }
+  return IntcodeMemory(parseIntcode(getPuzzleInput(path).front()));
+}
+
+void testIntcodeImage() {
+  cout << "Intcode image test begin\n";
+
+  // Day 9 quine spans a full page and a partial one once padded
+  vector<IntCode> program = parseIntcode("109,1,204,-1,1001,100,1,100,1008,100,16,101,1006,101,0,99");
+  const vector<IntCode> quine = program;
+  program.resize(memoryPageSize + 3, 0);
+  program.back() = -1125899906842624;
+  const string imagePath = "/tmp/intcode-image-test-" + to_string(getpid()) + ".bin";
+  writeIntcodeImage(program, imagePath);
+
+  const IntcodeImage image = mapIntcodeImage(imagePath);
+  assert(image.cellCount == program.size() && image.hash == hashIntcode(program));
+  assert(verifyIntcodeImage(image));
+  assert(image.memory.toVector() == program);
+
+  // Writes land in private copies, neither the image nor other VMs see them
+  IntcodeVM first(image.memory);
+  IntcodeVM second(image.memory);
+  assert(first.resume().outputs == quine && second.resume().outputs == quine);
+  assert(first.read(100) == 16 && image.memory.read(100) == 0);
+  assert(mapIntcodeImage(imagePath).memory.toVector() == program);
+  assert(loadIntcodeMemory(imagePath).toVector() == program);
+
+  remove(imagePath.c_str());
+  cout << "Intcode image test successful\n\n";
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <cstdio>
+#include <unistd.h>
+#include "IntcodeComputer.cpp"
+
+// Bounded LRU cache of the outputs of terminated runs, keyed by program hash
+// and input sequence. With a store path the entries are loaded from that file
+// on construction, so later processes start warm, and the file is rewritten
+// from the cache on save() and destruction: it never holds more than capacity
+// entries.
+class IntcodeResultCache
+{
+public:
+  size_t hits = 0;
+  size_t misses = 0;
+
+  explicit IntcodeResultCache(size_t capacity, const string &storePath = "")
+    : capacity(max<size_t>(capacity, 1)), storePath(storePath) {
+    if(storePath.empty()) {
+      return;
+    }
+    // Entry lines, least recently used first: programHash:input,input,...:output,output,...
+    for(const string &line : getPuzzleInput(storePath)) {
+      const auto fields = split(line, ":");
+      if(fields.size() == 3) {
+        remember({stoull(fields[0]), parseCells(fields[1])}, parseCells(fields[2]));
+      }
+    }
+  }
+
+  ~IntcodeResultCache() { save(); }
+
+  void save() {
+    lock_guard<mutex> lock(entriesLock);
+    if(storePath.empty()) {
+      return;
+    }
+    ofstream store(storePath, ios::trunc);
+    for(auto entry = entries.crbegin(); entry != entries.crend(); entry++) {
+      store << entry->first.programHash << ":" << joinCells(entry->first.inputs) << ":" << joinCells(entry->second) << "\n";
+    }
+  }
+
+  optional<vector<IntCode>> lookup(uint64_t programHash, const vector<IntCode> &inputs) {
+    lock_guard<mutex> lock(entriesLock);
+    const auto entry = index.find({programHash, inputs});
+    if(entry == index.end()) {
+      misses++;
+      return nullopt;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, entry->second);
+    return entry->second->second;
+  }
+
+  void insert(uint64_t programHash, const vector<IntCode> &inputs, const vector<IntCode> &outputs) {
+    lock_guard<mutex> lock(entriesLock);
+    remember({programHash, inputs}, outputs);
+  }
+
+  size_t size() const { return entries.size(); }
+
+private:
+  struct Key
+  {
+    uint64_t programHash;
+    vector<IntCode> inputs;
+    bool operator==(const Key &other) const { return programHash == other.programHash && inputs == other.inputs; }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key &k) const noexcept { return hashIntcode(k.inputs, k.programHash); }
+  };
+
+  using Entry = pair<Key, vector<IntCode>>;
+
+  size_t capacity;
+  list<Entry> entries {};
+  unordered_map<Key, list<Entry>::iterator, KeyHash> index {};
+  mutex entriesLock;
+  string storePath;
+
+  void remember(const Key &key, const vector<IntCode> &outputs) {
+    const auto known = index.find(key);
+    if(known != index.end()) {
+      entries.erase(known->second);
+      index.erase(known);
+    }
+    entries.push_front({key, outputs});
+    index[key] = entries.begin();
+    if(entries.size() > capacity) {
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+
+  static vector<IntCode> parseCells(const string &cells) {
+    return cells.empty() ? vector<IntCode>() : parseIntcode(cells);
+  }
+
+  static string joinCells(const vector<IntCode> &cells) {
+    string joined = "";
+    for(size_t i = 0; i < cells.size(); i++) {
+      joined += (i > 0 ? "," : "") + to_string(cells[i]);
+    }
+    return joined;
+  }
+};
+
+// A program run as a pure function of its inputs: terminated runs are
+// answered from the cache, runs waiting for more input are never cached.
+// The program is booted once, every run forks it where it waits for input.
+class MemoizedProgram
+{
+public:
+  MemoizedProgram(const vector<IntCode> &program, IntcodeResultCache &cache)
+    : loaded(IntcodeVM(program).resume().snapshot()), programHash(hashIntcode(program)), cache(cache) {}
+
+  vector<IntCode> run(const vector<IntCode> &inputs) {
+    if(auto outputs = cache.lookup(programHash, inputs)) {
+      return outputs.value();
+    }
+    auto vm = loaded.fork();
+    for(const IntCode input : inputs) {
+      vm.inputs.push(input);
+    }
+    vm.resume();
+    if(vm.terminated) {
+      cache.insert(programHash, inputs, vm.outputs);
+    }
+    return vm.outputs;
+  }
+
+private:
+  IntcodeSnapshot loaded;
+  uint64_t programHash;
+  IntcodeResultCache &cache;
+};
+
+void testIntcodeMemo() {
+  cout << "Intcode memo test begin\n";
+
+  // Terminated runs are cached, the store keeps the most recent ones only
+  const string storePath = "/tmp/intcode-memo-test-" + to_string(getpid()) + ".txt";
+  const auto doubler = parseIntcode("3,100,102,2,100,100,4,100,99");
+  {
+    IntcodeResultCache cache(2, storePath);
+    MemoizedProgram program(doubler, cache);
+    vector<IntCode> doubled;
+    for(const IntCode input : {1, 2, 3, 2}) {
+      doubled.push_back(program.run({input}).back());
+    }
+    assert(doubled == parseIntcode("2,4,6,4"));
+    assert(cache.hits == 1 && cache.misses == 3 && cache.size() == 2);
+  }
+  {
+    IntcodeResultCache reloaded(2, storePath);
+    MemoizedProgram program(doubler, reloaded);
+    for(const IntCode input : {2, 3, 1}) {
+      program.run({input});
+    }
+    assert(reloaded.hits == 2 && reloaded.misses == 1);
+  }
+  assert(getPuzzleInput(storePath).size() == 2);
+  remove(storePath.c_str());
+
+  cout << "Intcode memo test successful\n\n";
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include <iostream>
+#include <coroutine>
+#include <vector>
+#include <deque>
+#include <memory>
+#include "IntcodeComputer.cpp"
+
+// Needs C++20 (-std=c++20) for the coroutines.
+
+// Coroutine driving one stage of a pipeline, resumed by the pipeline scheduler
+struct IntcodeStageTask
+{
+  struct promise_type
+  {
+    IntcodeStageTask get_return_object() { return IntcodeStageTask(coroutine_handle<promise_type>::from_promise(*this)); }
+    suspend_always initial_suspend() noexcept { return {}; }
+    suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { terminate(); }
+  };
+
+  coroutine_handle<promise_type> handle;
+
+  explicit IntcodeStageTask(coroutine_handle<promise_type> h = nullptr) : handle(h) {}
+  IntcodeStageTask(IntcodeStageTask &&other) noexcept : handle(exchange(other.handle, nullptr)) {}
+  IntcodeStageTask &operator=(IntcodeStageTask &&other) noexcept {
+    swap(handle, other.handle);
+    return *this;
+  }
+  ~IntcodeStageTask() {
+    if(handle) handle.destroy();
+  }
+};
+
+// Bounded ring of values between pipeline stages. A stage awaiting room or a
+// value is parked on the channel and put back in the ready queue on change.
+class IntcodeChannel
+{
+public:
+  IntcodeChannel(deque<coroutine_handle<>> &ready, size_t capacity) : ready(ready), values(capacity) {}
+
+  bool empty() const { return count == 0; }
+  bool full() const { return count == values.size(); }
+
+  void push(IntCode value) {
+    assert(!full());
+    values[(head + count) % values.size()] = value;
+    count++;
+    wakeUp(readers);
+  }
+
+  optional<IntCode> tryPop() {
+    if(empty()) {
+      return nullopt;
+    }
+    const IntCode value = values[head];
+    head = (head + 1) % values.size();
+    count--;
+    wakeUp(writers);
+    return value;
+  }
+
+  struct Awaiter
+  {
+    bool isReady;
+    vector<coroutine_handle<>> &waiters;
+    bool await_ready() const noexcept { return isReady; }
+    void await_suspend(coroutine_handle<> h) { waiters.push_back(h); }
+    void await_resume() const noexcept {}
+  };
+
+  Awaiter readable() { return {!empty(), readers}; }
+  Awaiter writable() { return {!full(), writers}; }
+
+private:
+  deque<coroutine_handle<>> &ready;
+  vector<coroutine_handle<>> readers {};
+  vector<coroutine_handle<>> writers {};
+  vector<IntCode> values;
+  size_t head = 0;
+  size_t count = 0;
+
+  void wakeUp(vector<coroutine_handle<>> &waiters) {
+    ready.insert(ready.end(), waiters.begin(), waiters.end());
+    waiters.clear();
+  }
+};
+
+// VMs wired through bounded channels in any topology, feedback loops
+// included: every stage reads its own input channel and its outputs are
+// broadcast to the input channels of the stages it is connected to. Values
+// go straight from the output instruction of a VM to the input instruction
+// of the next one, no VM state is copied.
+class IntcodePipeline
+{
+public:
+  explicit IntcodePipeline(size_t channelCapacity = 16) : channelCapacity(channelCapacity) {}
+
+  size_t addStage(IntcodeVM vm) {
+    stages.push_back(make_unique<Stage>(Stage {move(vm), IntcodeChannel(ready, channelCapacity)}));
+    return stages.size() - 1;
+  }
+
+  void connect(size_t from, size_t to) {
+    stages[from]->outputs.push_back(&stages[to]->input);
+  }
+
+  // Queues an input of a stage, before the pipeline runs
+  void feed(size_t stage, IntCode value) {
+    stages[stage]->input.push(value);
+  }
+
+  // Runs every stage until it halts or waits for a value no stage will
+  // send, true when they all halted
+  bool run() {
+    for(auto &stage : stages) {
+      stage->task = runStage(*stage);
+      ready.push_back(stage->task.handle);
+    }
+    while(!ready.empty()) {
+      const coroutine_handle<> next = ready.front();
+      ready.pop_front();
+      next.resume();
+    }
+    return all_of(stages.cbegin(), stages.cend(), [](const auto &stage) { return stage->vm.terminated; });
+  }
+
+  optional<IntCode> lastOutput(size_t stage) const { return stages[stage]->lastOutput; }
+
+private:
+  struct Stage
+  {
+    IntcodeVM vm;
+    IntcodeChannel input;
+    vector<IntcodeChannel *> outputs {};
+    optional<IntCode> lastOutput {};
+    IntcodeStageTask task {};
+  };
+
+  size_t channelCapacity;
+  vector<unique_ptr<Stage>> stages {};
+  deque<coroutine_handle<>> ready {};
+
+  // The VM pauses after every output and every output channel has room right
+  // before each resume: other stages can fill a shared channel while this one
+  // waits for input
+  static IntcodeStageTask runStage(Stage &stage) {
+    stage.vm.setInputProvider([&stage]() { return stage.input.tryPop(); });
+    stage.vm.setOutputSink([&stage](IntCode value) {
+      stage.lastOutput = value;
+      for(IntcodeChannel *output : stage.outputs) {
+        output->push(value);
+      }
+    });
+    stage.vm.pauseAfterOutputs(1);
+    while(true) {
+      for(IntcodeChannel *output : stage.outputs) {
+        while(output->full()) {
+          co_await output->writable();
+        }
+      }
+      if(stage.vm.resume().terminated) {
+        co_return;
+      }
+      while(stage.vm.waitingForInput() && stage.input.empty()) {
+        co_await stage.input.readable();
+      }
+    }
+  }
+};
+
+void testIntcodePipeline() {
+  cout << "Intcode pipeline test begin\n";
+
+  // Fan-in on single value channels: B and A both send to C, A only once D
+  // fed it, by then B may have filled C's channel again
+  IntcodePipeline fanIn(1);
+  const size_t c = fanIn.addStage(IntcodeVM(parseIntcode("3,100,3,101,1,100,101,102,4,102,99")));
+  const size_t a = fanIn.addStage(IntcodeVM(parseIntcode("3,100,4,100,99")));
+  const size_t d = fanIn.addStage(IntcodeVM(parseIntcode("104,5,99")));
+  const size_t b = fanIn.addStage(IntcodeVM(parseIntcode("104,7,99")));
+  fanIn.connect(a, c);
+  fanIn.connect(d, a);
+  fanIn.connect(b, c);
+  assert(fanIn.run() && fanIn.lastOutput(c) == 12);
+
+  // Chain and broadcast: the doubled value reaches both sinks
+  IntcodePipeline broadcast(1);
+  const size_t doubler = broadcast.addStage(IntcodeVM(parseIntcode("3,100,102,2,100,100,4,100,99")));
+  const size_t first = broadcast.addStage(IntcodeVM(parseIntcode("3,100,4,100,99")));
+  const size_t second = broadcast.addStage(IntcodeVM(parseIntcode("3,100,4,100,99")));
+  broadcast.connect(doubler, first);
+  broadcast.connect(doubler, second);
+  broadcast.feed(doubler, 21);
+  assert(broadcast.run() && broadcast.lastOutput(first) == 42 && broadcast.lastOutput(second) == 42);
+
+  cout << "Intcode pipeline test successful\n\n";
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <unordered_map>
+#include <numeric>
+#include "IntcodeComputer.cpp"
+
+// Instrumentation policy counting executed instructions per decoded
+// instruction (opcode and parameter modes) and per program counter, memory
+// growth events and input starvation pauses. Program counters are counted
+// sparsely, far jumps cost a single counter. Only VMs instantiated with it
+// pay for the counting: ProfiledIntcodeVM vm(program);
+struct IntcodeProfiler
+{
+  array<uint64_t, instructionTableSize> instructions {};
+  unordered_map<size_t, uint64_t> programCounters {};
+  uint64_t memoryGrowthEvents = 0;
+  uint64_t inputStarvations = 0;
+
+  void onInstruction(size_t instructionPointer, DecodedInstruction instruction) {
+    instructions[instruction]++;
+    programCounters[instructionPointer]++;
+  }
+
+  void onInputStarved(size_t) {
+    inputStarvations++;
+  }
+
+  void onMemoryGrowth(size_t) {
+    memoryGrowthEvents++;
+  }
+
+  void onOperands(IntCode, IntCode) {}
+  void onMemoryWrite(size_t, IntCode, IntCode) {}
+  void onFault() {}
+
+  uint64_t executedInstructions() const {
+    return accumulate(instructions.cbegin(), instructions.cend(), uint64_t(0));
+  }
+
+  // Executed instructions per opcode, 99 for halt
+  map<int, uint64_t> opcodes() const {
+    map<int, uint64_t> counts;
+    for(size_t i = 0; i < instructions.size(); i++) {
+      if(instructions[i] > 0) {
+        counts[i == haltInstruction ? 99 : i / 27] += instructions[i];
+      }
+    }
+    return counts;
+  }
+
+  // Executed instructions per parameter mode, over every parameter of every instruction
+  array<uint64_t, 3> parameterModes() const {
+    array<uint64_t, 3> counts {};
+    for(size_t i = 0; i < instructions.size(); i++) {
+      const size_t code = i / 27;
+      const size_t parameters = code == 1 || code == 2 || code == 7 || code == 8 ? 3 : code == 5 || code == 6 ? 2 : code >= 3 && code <= 9 ? 1 : 0;
+      for(size_t p = 0, modes = i % 27; p < parameters; p++, modes /= 3) {
+        counts[modes % 3] += instructions[i];
+      }
+    }
+    return counts;
+  }
+
+  // Program counters sorted by decreasing execution count
+  vector<pair<size_t, uint64_t>> hotProgramCounters() const {
+    vector<pair<size_t, uint64_t>> hot(programCounters.cbegin(), programCounters.cend());
+    sort(hot.begin(), hot.end(), [](const auto &a, const auto &b) {
+      return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    return hot;
+  }
+
+  void report(ostream &os, size_t hotCount = 20) const {
+    const uint64_t total = executedInstructions();
+    os << "Intcode profile: " << total << " instructions, "
+       << memoryGrowthEvents << " memory growth events, "
+       << inputStarvations << " input starvation pauses\n";
+    os << "Opcodes:\n";
+    for(const auto &[code, count] : opcodes()) {
+      os << "  " << setw(2) << code << ": " << count << "\n";
+    }
+    const auto modes = parameterModes();
+    os << "Parameter modes: position " << modes[PositionMode] << ", immediate " << modes[ImmediateMode] << ", relative " << modes[RelativeMode] << "\n";
+    os << "Hot program counters:\n";
+    const auto hot = hotProgramCounters();
+    for(size_t i = 0; i < min(hotCount, hot.size()); i++) {
+      os << "  pc " << setw(6) << hot[i].first << ": " << hot[i].second
+         << " (" << fixed << setprecision(1) << 100.0 * hot[i].second / total << "%)\n";
+    }
+  }
+
+  void writeJson(const string &path) const {
+    ofstream json(path);
+    json << "{\n  \"instructions\": " << executedInstructions()
+         << ",\n  \"memoryGrowthEvents\": " << memoryGrowthEvents
+         << ",\n  \"inputStarvations\": " << inputStarvations
+         << ",\n  \"opcodes\": {";
+    string separator = "";
+    for(const auto &[code, count] : opcodes()) {
+      json << separator << "\"" << code << "\": " << count;
+      separator = ", ";
+    }
+    const auto modes = parameterModes();
+    json << "},\n  \"parameterModes\": {\"position\": " << modes[PositionMode]
+         << ", \"immediate\": " << modes[ImmediateMode] << ", \"relative\": " << modes[RelativeMode] << "}"
+         << ",\n  \"hotProgramCounters\": [";
+    separator = "";
+    for(const auto &[pc, count] : hotProgramCounters()) {
+      json << separator << "\n    {\"pc\": " << pc << ", \"count\": " << count << "}";
+      separator = ",";
+    }
+    json << "\n  ]\n}\n";
+  }
+};
+
+using ProfiledIntcodeVM = BasicIntcodeVM<IntcodeProfiler>;
@@ -0,0 +1,374 @@
+#pragma once
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include "IntcodeComputer.cpp"
+
+// Polynomial with IntCode coefficients over variables x0, x1... Every
+// operation returns nullopt rather than overflow.
+class IntcodePolynomial
+{
+public:
+  // Exponent of each variable
+  using Monomial = vector<unsigned>;
+
+  explicit IntcodePolynomial(IntCode constant = 0) {
+    if(constant != 0) {
+      terms[{}] = constant;
+    }
+  }
+
+  static IntcodePolynomial variable(size_t index) {
+    IntcodePolynomial p;
+    Monomial m(index + 1, 0);
+    m[index] = 1;
+    p.terms[m] = 1;
+    return p;
+  }
+
+  bool isConstant() const { return terms.empty() || (terms.size() == 1 && terms.count({})); }
+  IntCode constant() const {
+    const auto c = terms.find({});
+    return c != terms.end() ? c->second : 0;
+  }
+
+  unsigned degree(size_t variable) const {
+    unsigned d = 0;
+    for(const auto &[m, coefficient] : terms) {
+      d = max(d, exponent(m, variable));
+    }
+    return d;
+  }
+
+  // Coefficient of variable^power, a polynomial of the other variables
+  IntcodePolynomial coefficient(size_t variable, unsigned power) const {
+    IntcodePolynomial c;
+    for(const auto &[m, coefficient] : terms) {
+      if(exponent(m, variable) == power) {
+        Monomial rest = m;
+        if(variable < rest.size()) {
+          rest[variable] = 0;
+        }
+        c.terms[normalized(rest)] = coefficient;
+      }
+    }
+    return c;
+  }
+
+  friend optional<IntcodePolynomial> operator+(const IntcodePolynomial &a, const IntcodePolynomial &b) {
+    IntcodePolynomial sum = a;
+    for(const auto &[m, coefficient] : b.terms) {
+      if(!sum.accumulate(m, coefficient)) {
+        return nullopt;
+      }
+    }
+    return sum;
+  }
+
+  friend optional<IntcodePolynomial> operator*(const IntcodePolynomial &a, const IntcodePolynomial &b) {
+    IntcodePolynomial product;
+    for(const auto &[ma, ca] : a.terms) {
+      for(const auto &[mb, cb] : b.terms) {
+        IntCode c;
+        if(__builtin_mul_overflow(ca, cb, &c)) {
+          return nullopt;
+        }
+        Monomial m(max(ma.size(), mb.size()), 0);
+        for(size_t v = 0; v < m.size(); v++) {
+          m[v] = exponent(ma, v) + exponent(mb, v);
+        }
+        if(!product.accumulate(m, c)) {
+          return nullopt;
+        }
+      }
+    }
+    return product;
+  }
+
+  // The variable replaced by a value
+  optional<IntcodePolynomial> substitute(size_t variable, IntCode value) const {
+    IntcodePolynomial result;
+    for(const auto &[m, coefficient] : terms) {
+      IntCode c = coefficient;
+      for(unsigned i = 0; i < exponent(m, variable); i++) {
+        if(__builtin_mul_overflow(c, value, &c)) {
+          return nullopt;
+        }
+      }
+      Monomial rest = m;
+      if(variable < rest.size()) {
+        rest[variable] = 0;
+      }
+      if(!result.accumulate(normalized(rest), c)) {
+        return nullopt;
+      }
+    }
+    return result;
+  }
+
+  bool operator==(const IntcodePolynomial &other) const { return terms == other.terms; }
+
+  friend ostream &operator<<(ostream &os, const IntcodePolynomial &p) {
+    if(p.terms.empty()) {
+      return os << 0;
+    }
+    string separator = "";
+    for(auto t = p.terms.rbegin(); t != p.terms.rend(); t++) {
+      os << separator;
+      string factor = t->second != 1 || t->first.empty() ? to_string(t->second) : "";
+      for(size_t v = 0; v < t->first.size(); v++) {
+        if(t->first[v] > 0) {
+          os << factor << (factor.empty() ? "" : "*") << "x" << v << (t->first[v] > 1 ? "^" + to_string(t->first[v]) : "");
+          factor = "";
+        }
+      }
+      os << factor;
+      separator = " + ";
+    }
+    return os;
+  }
+
+private:
+  map<Monomial, IntCode> terms {}; // no zero coefficient, no trailing zero exponent
+
+  static unsigned exponent(const Monomial &m, size_t variable) {
+    return variable < m.size() ? m[variable] : 0;
+  }
+
+  static Monomial normalized(Monomial m) {
+    while(!m.empty() && m.back() == 0) {
+      m.pop_back();
+    }
+    return m;
+  }
+
+  bool accumulate(const Monomial &m, IntCode coefficient) {
+    const Monomial key = normalized(m);
+    IntCode &c = terms[key];
+    if(__builtin_add_overflow(c, coefficient, &c)) {
+      return false;
+    }
+    if(c == 0) {
+      terms.erase(key);
+    }
+    return true;
+  }
+};
+
+// Runs a program with some of its cells replaced by variables: straight-line
+// arithmetic on them is tracked as polynomials. Comparing two of them or
+// reading through an address depending on a variable gives an unknown value,
+// which only stops the run once it is needed: as an instruction, a jump
+// condition or target, a written address or a relative base.
+class SymbolicIntcodeRun
+{
+public:
+  bool halted = false;
+  vector<optional<IntcodePolynomial>> outputs {};
+
+  SymbolicIntcodeRun(const vector<IntCode> &program, const vector<size_t> &variableCells, queue<IntCode> inputs = {})
+    : program(program), inputs(move(inputs)) {
+    for(size_t v = 0; v < variableCells.size(); v++) {
+      cells[variableCells[v]] = IntcodePolynomial::variable(v);
+    }
+  }
+
+  // False when a variable decides how the program goes on (the concrete
+  // values must then be tried), when it waits for an input or runs for more
+  // than maxInstructions
+  bool run(size_t maxInstructions = 10000000) {
+    for(size_t executed = 0; !halted; executed++) {
+      if(executed == maxInstructions || !step()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // nullopt when unknown
+  optional<IntcodePolynomial> cell(size_t address) const {
+    const auto c = cells.find(address);
+    if(c != cells.end()) {
+      return c->second;
+    }
+    return IntcodePolynomial(address < program.size() ? program[address] : 0);
+  }
+
+private:
+  const vector<IntCode> program;
+  queue<IntCode> inputs;
+  unordered_map<size_t, optional<IntcodePolynomial>> cells {};
+  size_t instructionPointer = 0;
+  IntCode relativeBase = 0;
+
+  optional<IntCode> concrete(size_t address) const {
+    const auto c = cell(address);
+    return c && c->isConstant() ? optional<IntCode>(c->constant()) : nullopt;
+  }
+
+  optional<size_t> address(size_t param, int mode) const {
+    if(mode == ImmediateMode) {
+      return instructionPointer + param;
+    }
+    const auto a = concrete(instructionPointer + param);
+    const IntCode base = mode == RelativeMode ? relativeBase : 0;
+    return a && *a + base >= 0 ? optional<size_t>(*a + base) : nullopt;
+  }
+
+  optional<IntcodePolynomial> value(size_t param, int mode) const {
+    const auto a = address(param, mode);
+    return a ? cell(*a) : nullopt;
+  }
+
+  bool step() {
+    const auto instruction = concrete(instructionPointer);
+    if(!instruction) {
+      return false;
+    }
+    const DecodedInstruction decoded = decodeInstruction(*instruction);
+    const int code = decoded / 27;
+    const int mode1 = decoded % 3, mode2 = decoded / 3 % 3, mode3 = decoded / 9 % 3;
+    if(decoded == haltInstruction) {
+      halted = true;
+      return true;
+    }
+    if(decoded == invalidInstruction) {
+      return false;
+    }
+    if(code == 1 || code == 2 || code == 7 || code == 8) {
+      const auto a = value(1, mode1);
+      const auto b = value(2, mode2);
+      const auto target = address(3, mode3);
+      if(!target) {
+        return false;
+      }
+      optional<IntcodePolynomial> result {};
+      if(a && b && code == 1) {
+        result = *a + *b;
+      } else if(a && b && code == 2) {
+        result = *a * *b;
+      } else if(a && b && a->isConstant() && b->isConstant()) {
+        result = IntcodePolynomial(code == 7 ? a->constant() < b->constant() : a->constant() == b->constant());
+      } else if(a && b && code == 8 && *a == *b) {
+        result = IntcodePolynomial(1);
+      }
+      cells[*target] = result;
+      instructionPointer += 4;
+    }
+    else if(code == 3) {
+      const auto target = address(1, mode1);
+      if(inputs.empty() || !target) {
+        return false;
+      }
+      cells[*target] = IntcodePolynomial(inputs.front());
+      inputs.pop();
+      instructionPointer += 2;
+    }
+    else if(code == 4) {
+      outputs.push_back(value(1, mode1));
+      instructionPointer += 2;
+    }
+    else if(code == 5 || code == 6) {
+      const auto condition = value(1, mode1);
+      if(!condition || !condition->isConstant()) {
+        return false;
+      }
+      if((code == 5) == (condition->constant() != 0)) {
+        const auto target = value(2, mode2);
+        if(!target || !target->isConstant() || target->constant() < 0) {
+          return false;
+        }
+        instructionPointer = target->constant();
+      } else {
+        instructionPointer += 3;
+      }
+    }
+    else if(code == 9) {
+      const auto offset = value(1, mode1);
+      if(!offset || !offset->isConstant()) {
+        return false;
+      }
+      relativeBase += offset->constant();
+      instructionPointer += 2;
+    }
+    return true;
+  }
+};
+
+// First values of the variables, in lexicographic order within their
+// [first, last) ranges, for which the polynomial equals target. The last
+// variable is solved for when the polynomial is linear in it, scanned otherwise.
+optional<vector<IntCode>> solveIntcodePolynomial(const IntcodePolynomial &p, IntCode target, const vector<pair<IntCode, IntCode>> &ranges, vector<IntCode> assigned = {}) {
+  const size_t variable = assigned.size();
+  if(variable == ranges.size()) {
+    return p.isConstant() && p.constant() == target ? optional<vector<IntCode>>(assigned) : nullopt;
+  }
+  const auto [first, last] = ranges[variable];
+  if(variable + 1 == ranges.size() && p.degree(variable) == 1) {
+    const IntcodePolynomial slope = p.coefficient(variable, 1);
+    const IntcodePolynomial offset = p.coefficient(variable, 0);
+    if(!slope.isConstant() || !offset.isConstant()) {
+      return nullopt;
+    }
+    // No solution fits an IntCode when the difference or the quotient overflows
+    const IntCode divisor = slope.constant();
+    IntCode difference;
+    if(__builtin_sub_overflow(target, offset.constant(), &difference)
+      || (divisor == -1 && difference == numeric_limits<IntCode>::min())) {
+      return nullopt;
+    }
+    if(difference % divisor != 0 || difference / divisor < first || difference / divisor >= last) {
+      return nullopt;
+    }
+    assigned.push_back(difference / divisor);
+    return assigned;
+  }
+  for(IntCode value = first; value < last; value++) {
+    const auto substituted = p.substitute(variable, value);
+    assigned.push_back(value);
+    if(substituted) {
+      if(auto solution = solveIntcodePolynomial(*substituted, target, ranges, assigned)) {
+        return solution;
+      }
+    }
+    assigned.pop_back();
+  }
+  return nullopt;
+}
+
+void testIntcodeSymbolic() {
+  cout << "Intcode symbolic test begin\n";
+
+  // mem[0] = (x0 + x1) * x1
+  SymbolicIntcodeRun straight(parseIntcode("1,9,10,11,2,11,10,0,99,0,0,0"), {9, 10});
+  assert(straight.run() && straight.halted);
+  const auto result = straight.cell(0);
+  assert(result && result->degree(0) == 1 && result->degree(1) == 2);
+  // x0 = 2, x1 = 4 is the first solution of (x0 + x1) * x1 = 24
+  assert(solveIntcodePolynomial(*result, 24, {{0, 10}, {0, 10}}) == vector<IntCode>({2, 4}));
+  assert(!solveIntcodePolynomial(*result, 97, {{0, 10}, {0, 10}}));
+
+  // Linear in the last variable: solved without scanning it
+  SymbolicIntcodeRun linear(parseIntcode("1002,9,100,9,1,9,10,0,99,0,0"), {9, 10});
+  assert(linear.run());
+  assert(solveIntcodePolynomial(*linear.cell(0), 6718, {{0, 100}, {0, 100}}) == vector<IntCode>({67, 18}));
+
+  // Targets out of reach of an IntCode have no solution
+  const auto shifted = IntcodePolynomial::variable(0) + IntcodePolynomial(-10);
+  assert(!solveIntcodePolynomial(*shifted, numeric_limits<IntCode>::max(), {{0, 100}}));
+  const auto negated = IntcodePolynomial::variable(0) * IntcodePolynomial(-1);
+  assert(!solveIntcodePolynomial(*negated, numeric_limits<IntCode>::min(), {{0, 100}}));
+  assert(solveIntcodePolynomial(*negated, -42, {{0, 100}}) == vector<IntCode>({42}));
+
+  // Reading through a variable address is only fatal when the value is used
+  SymbolicIntcodeRun deadRead(parseIntcode("1,0,0,9,1101,5,6,9,99,0"), {1, 2});
+  assert(deadRead.run() && deadRead.cell(9) == IntcodePolynomial(11));
+  SymbolicIntcodeRun usedRead(parseIntcode("1,0,0,7,4,7,99,0"), {1, 2});
+  assert(usedRead.run() && usedRead.outputs.size() == 1 && !usedRead.outputs.front());
+
+  // Branching on a variable stops the run
+  SymbolicIntcodeRun branch(parseIntcode("1005,9,6,104,0,99,104,1,99,0"), {9});
+  assert(!branch.run() && !branch.halted);
+
+  cout << "Intcode symbolic test successful\n\n";
+}
@@ -0,0 +1,179 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include "IntcodeComputer.cpp"
+
+// Instrumentation policy keeping the last executed instructions: program
+// counter, instruction, the values read by its first two parameters and the
+// cell it wrote. The ring has Capacity slots and keeps the newest Capacity - 1
+// entries, the slot being written is never read. Nothing is printed while the
+// program runs, the ring is dumped on a fault (invalid opcode, negative
+// address...) or on request with dump(). Only VMs instantiated with it pay for
+// the recording:
+// TracedIntcodeVM vm(program);
+//
+// The VM is the only writer and publishes each entry by moving the head, so
+// another thread can dump a running VM without stopping it: entries the VM
+// overwrote meanwhile are dropped, the newest one may lack its operands.
+template<size_t Capacity = 256>
+class IntcodeTracer
+{
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "the capacity must be a power of 2");
+
+public:
+  static constexpr size_t noWrite = numeric_limits<size_t>::max();
+
+  struct Entry
+  {
+    size_t instructionPointer = 0;
+    DecodedInstruction instruction = notDecoded;
+    IntCode first = 0;
+    IntCode second = 0;
+    size_t address = noWrite;
+    IntCode value = 0;
+  };
+
+  IntcodeTracer() = default;
+  // Forks start with the history of the VM they were forked from
+  IntcodeTracer(const IntcodeTracer &other) { *this = other; }
+  IntcodeTracer &operator=(const IntcodeTracer &other) {
+    for(size_t i = 0; i < Capacity; i++) {
+      save(ring[i], load(other.ring[i]));
+    }
+    head.store(other.head.load(memory_order_acquire), memory_order_release);
+    return *this;
+  }
+
+  void onInstruction(size_t instructionPointer, DecodedInstruction instruction) {
+    const uint64_t next = head.load(memory_order_relaxed);
+    save(ring[next & mask], {instructionPointer, instruction});
+    head.store(next + 1, memory_order_release);
+  }
+
+  void onOperands(IntCode first, IntCode second) {
+    Slot &slot = newest();
+    slot.first.store(first, memory_order_relaxed);
+    slot.second.store(second, memory_order_relaxed);
+  }
+
+  void onMemoryWrite(size_t address, IntCode, IntCode value) {
+    Slot &slot = newest();
+    slot.address.store(address, memory_order_relaxed);
+    slot.value.store(value, memory_order_relaxed);
+  }
+
+  void onInputStarved(size_t) {}
+  void onMemoryGrowth(size_t) {}
+
+  void onFault() {
+    cerr << "Last executed instructions:\n";
+    dump(cerr);
+  }
+
+  uint64_t executedInstructions() const { return head.load(memory_order_acquire); }
+
+  // Oldest first, at most Capacity - 1 of them
+  vector<Entry> entries() const {
+    const uint64_t end = head.load(memory_order_acquire);
+    const uint64_t begin = end >= Capacity ? end - Capacity + 1 : 0;
+    vector<Entry> recorded;
+    recorded.reserve(end - begin);
+    for(uint64_t i = begin; i < end; i++) {
+      recorded.push_back(load(ring[i & mask]));
+    }
+    // The slot of entry h - Capacity is being written once the head reads h
+    const uint64_t reused = head.load(memory_order_acquire);
+    const uint64_t firstIntact = reused >= Capacity ? reused - Capacity + 1 : 0;
+    if(firstIntact > begin) {
+      recorded.erase(recorded.begin(), recorded.begin() + min<uint64_t>(firstIntact - begin, recorded.size()));
+    }
+    return recorded;
+  }
+
+  // One line per instruction: program counter, instruction with its modes,
+  // operands then the written cell
+  void dump(ostream &os) const {
+    for(const Entry &e : entries()) {
+      os << setw(8) << e.instructionPointer << ": " << setw(5) << instructionText(e.instruction)
+         << " " << setw(20) << e.first << " " << setw(20) << e.second;
+      if(e.address != noWrite) {
+        os << "  [" << e.address << "] = " << e.value;
+      }
+      os << "\n";
+    }
+  }
+
+private:
+  static constexpr size_t mask = Capacity - 1;
+
+  struct Slot
+  {
+    atomic<size_t> instructionPointer {0};
+    atomic<DecodedInstruction> instruction {notDecoded};
+    atomic<IntCode> first {0};
+    atomic<IntCode> second {0};
+    atomic<size_t> address {noWrite};
+    atomic<IntCode> value {0};
+  };
+
+  array<Slot, Capacity> ring {};
+  atomic<uint64_t> head {0};
+
+  Slot &newest() { return ring[(head.load(memory_order_relaxed) - 1) & mask]; }
+
+  static void save(Slot &slot, const Entry &e) {
+    slot.instructionPointer.store(e.instructionPointer, memory_order_relaxed);
+    slot.instruction.store(e.instruction, memory_order_relaxed);
+    slot.first.store(e.first, memory_order_relaxed);
+    slot.second.store(e.second, memory_order_relaxed);
+    slot.address.store(e.address, memory_order_relaxed);
+    slot.value.store(e.value, memory_order_relaxed);
+  }
+
+  static Entry load(const Slot &slot) {
+    return {slot.instructionPointer.load(memory_order_relaxed), slot.instruction.load(memory_order_relaxed),
+      slot.first.load(memory_order_relaxed), slot.second.load(memory_order_relaxed),
+      slot.address.load(memory_order_relaxed), slot.value.load(memory_order_relaxed)};
+  }
+
+  // The instruction as written in the program, modes first
+  static string instructionText(DecodedInstruction instruction) {
+    if(instruction == haltInstruction) {
+      return "99";
+    }
+    return to_string(instruction % 3 * 100 + instruction / 3 % 3 * 1000 + instruction / 9 % 3 * 10000 + instruction / 27);
+  }
+};
+
+using TracedIntcodeVM = BasicIntcodeVM<IntcodeTracer<>>;
+
+void testIntcodeTrace() {
+  cout << "Intcode trace test begin\n";
+
+  // Every instruction is recorded with what it read and wrote
+  TracedIntcodeVM vm(parseIntcode("3,100,1002,100,3,101,109,7,22101,1,94,0,4,7,99"));
+  vm.inputs.push(14);
+  assert(vm.resume().terminated && vm.outputs == parseIntcode("43"));
+  const auto entries = vm.instrumentation.entries();
+  assert(entries.size() == 6 && vm.instrumentation.executedInstructions() == 6);
+  assert(entries[0].instructionPointer == 0 && entries[0].address == 100 && entries[0].value == 14);
+  assert(entries[1].instruction == 2 * 27 + 1 * 3 && entries[1].first == 14 && entries[1].second == 3 && entries[1].value == 42);
+  assert(entries[2].first == 7 && entries[2].address == IntcodeTracer<>::noWrite);
+  assert(entries[3].first == 1 && entries[3].second == 42 && entries[3].address == 7 && entries[3].value == 43);
+  assert(entries[4].first == 43 && entries[5].instruction == haltInstruction);
+  ostringstream dumped;
+  vm.instrumentation.dump(dumped);
+  assert(dumped.str().find("22101") != string::npos && dumped.str().find("[7] = 43") != string::npos);
+
+  // Only the newest entries are kept, forks take the history along
+  IntcodeTracer<4> ring;
+  for(size_t pc = 0; pc < 10; pc++) {
+    ring.onInstruction(pc, haltInstruction);
+  }
+  const IntcodeTracer<4> forked = ring;
+  const auto kept = forked.entries();
+  assert(kept.size() == 3 && kept.front().instructionPointer == 7 && forked.executedInstructions() == 10);
+
+  cout << "Intcode trace test successful\n\n";
+}
@@ -23,16 +23,22 @@ PaintedPanels paint(const Color startPanelColor = Black) {
   };
 
   const auto painRobotProgram = parseIntcode(getPuzzleInput("inputs/aoc_day11_1.txt").front());
-  auto robotProgram = runProgram(painRobotProgram);
+  IntcodeVM robotProgram(painRobotProgram);
+  // The robot stops after each (color, turn) pair
+  robotProgram.pauseAfterOutputs(2);
   Coordinate robotCoordinate {0, 0};
   Direction robotDirection = Up;
   bool isFirstPanel = true;
-  while(!robotProgram.terminated) {
+  while(true) {
     const auto currentPanelColor = isFirstPanel ? startPanelColor : getPanelColor(robotCoordinate);
     robotProgram.inputs.push(currentPanelColor);
-    robotProgram = runProgram(robotProgram);
-    const auto paintedColor = static_cast<Color>(robotProgram.outputs.at(robotProgram.outputs.size() - 2));
-    const auto nextTurn = static_cast<Turn>(robotProgram.outputs.back());
+    robotProgram.resume();
+    if(robotProgram.terminated) {
+      break;
+    }
+    const auto paintedColor = static_cast<Color>(robotProgram.outputs.at(0));
+    const auto nextTurn = static_cast<Turn>(robotProgram.outputs.at(1));
+    robotProgram.outputs.clear();
     panels.insert_or_assign(robotCoordinate, paintedColor);
 
     if((robotDirection == Up && nextTurn == LeftTurn) || (robotDirection == Down && nextTurn == RightTurn)) {
@@ -1,34 +1,85 @@
 #include <iostream>
 #include <algorithm>
+#include <cassert>
+#include <chrono>
 #include "IntcodeComputer.cpp"
+#include "IntcodeCheckpoint.cpp"
 #include "coordinate.cpp"
 
 enum class Move {North=1, South, West, East};
-enum class DroidStatus {HitWall=1, Moved, MovedAndFoundSystem};
-enum class Tile {Empty, Wall, OxygenSystem};
+enum class DroidStatus {HitWall, Moved, MovedAndFoundSystem};
+enum class Tile {Unknown, Empty, Wall, OxygenSystem};
 
-using Screen = unordered_map<Coordinate, Tile, CoordinateHash>;
+const array<Coordinate, 4> moveOffsets {{{0, -1}, {0, 1}, {-1, 0}, {1, 0}}};
 
-string screenToString(const Screen &s) {
-  int minX = 0;
-  int maxX = 0;
-  int minY = 0;
-  int maxY = 0;
+Coordinate operator+ (const Coordinate &c, const Coordinate &offset) {
+  return {c.x + offset.x, c.y + offset.y};
+}
+
+// Dense map of the area around the start, doubled on every side when the
+// droid steps out of it
+class Screen
+{
+public:
+  Tile at(const Coordinate &c) const {
+    return inside(c) ? tiles[index(c)] : Tile::Unknown;
+  }
+
+  void set(const Coordinate &c, Tile tile) {
+    while(!inside(c)) {
+      grow();
+    }
+    tiles[index(c)] = tile;
+  }
+
+  Coordinate topLeft() const { return origin; }
+  Coordinate bottomRight() const { return {origin.x + width - 1, origin.y + height - 1}; }
+
+private:
+  Coordinate origin {-8, -8};
+  int width = 16;
+  int height = 16;
+  vector<Tile> tiles = vector<Tile>(16 * 16, Tile::Unknown);
+
+  bool inside(const Coordinate &c) const {
+    return c.x >= origin.x && c.y >= origin.y && c.x < origin.x + width && c.y < origin.y + height;
+  }
+
+  size_t index(const Coordinate &c) const {
+    return size_t(c.y - origin.y) * width + (c.x - origin.x);
+  }
+
+  void grow() {
+    vector<Tile> grown(size_t(width) * height * 4, Tile::Unknown);
+    for(int y = 0; y < height; y++) {
+      copy_n(tiles.cbegin() + size_t(y) * width, width, grown.begin() + size_t(y + height / 2) * width * 2 + width / 2);
+    }
+    origin = {origin.x - width / 2, origin.y - height / 2};
+    width *= 2;
+    height *= 2;
+    tiles = move(grown);
+  }
+};
 
-  for(const auto [coord, tile] : s) {
-    if(minX > coord.x) minX = coord.x;
-    else if(maxX < coord.x) maxX = coord.x;
-    
-    if(minY > coord.y) minY = coord.y;
-    else if(maxY < coord.y) maxY = coord.y;
+string screenToString(const Screen &s) {
+  Coordinate low = s.bottomRight();
+  Coordinate high = s.topLeft();
+  for(int y = s.topLeft().y; y <= s.bottomRight().y; y++) {
+    for(int x = s.topLeft().x; x <= s.bottomRight().x; x++) {
+      if(s.at({x, y}) != Tile::Unknown) {
+        low = {min(low.x, x), min(low.y, y)};
+        high = {max(high.x, x), max(high.y, y)};
+      }
+    }
   }
 
   string res = "";
-  for (int y = 0; y <= maxY; y++) {
-    for (int x = 0; x <= maxX; x++) {
+  for (int y = low.y; y <= high.y; y++) {
+    for (int x = low.x; x <= high.x; x++) {
       const auto t = s.at({x,y});
-      res += 
-        t == Tile::Empty ? " " :
+      res +=
+        x == 0 && y == 0 ? "D" :
+        t == Tile::Empty || t == Tile::Unknown ? " " :
         t == Tile::Wall ? "%" :
         "O";
     }
@@ -37,15 +88,140 @@ string screenToString(const Screen &s) {
   return res;
 }
 
-int main(int argc, char const *argv[]){
-  const auto remoteInput = getPuzzleInput("inputs/aoc_day15_1.txt").front();
-  auto droid = runProgram(remoteInput);
+// Only counts executed instructions, the explored map must not depend on it
+struct InstructionCounter
+{
+  uint64_t executed = 0;
+  void onInstruction(size_t, DecodedInstruction) { executed++; }
+  void onOperands(IntCode, IntCode) {}
+  void onInputStarved(size_t) {}
+  void onMemoryGrowth(size_t) {}
+  void onMemoryWrite(size_t, IntCode, IntCode) {}
+  void onFault() {}
+};
+
+using CountedIntcodeVM = BasicIntcodeVM<InstructionCounter>;
+
+struct Exploration
+{
+  Screen screen;
+  Coordinate oxygenSystem;
+  int movesToOxygenSystem = -1;
+  size_t droidMoves = 0;
+  uint64_t instructions = 0;
+};
+
+// Breadth first search of the whole area: every droid of the frontier is a
+// fork of the one that reached its position, trying a move never needs the
+// moves back
+template<typename VM>
+Exploration explore(const vector<IntCode> &program) {
+  Exploration e;
+  e.screen.set({0, 0}, Tile::Empty);
+  VM start(program);
+  start.resume();
+  if constexpr(is_same_v<VM, CountedIntcodeVM>) {
+    e.instructions = start.instrumentation.executed;
+  }
+  vector<pair<VM, Coordinate>> frontier;
+  frontier.push_back({move(start), {0, 0}});
+  for(int distance = 1; !frontier.empty(); distance++) {
+    vector<pair<VM, Coordinate>> next;
+    for(const auto &[droid, position] : frontier) {
+      for(size_t m = 0; m < moveOffsets.size(); m++) {
+        const Coordinate to = position + moveOffsets[m];
+        if(e.screen.at(to) != Tile::Unknown) {
+          continue;
+        }
+        VM moved = droid.fork();
+        moved.inputs.push(IntCode(m) + IntCode(Move::North));
+        const DroidStatus status = DroidStatus(moved.resume().outputs.back());
+        e.droidMoves++;
+        if constexpr(is_same_v<VM, CountedIntcodeVM>) {
+          e.instructions += moved.instrumentation.executed - droid.instrumentation.executed;
+        }
+        if(status == DroidStatus::HitWall) {
+          e.screen.set(to, Tile::Wall);
+          continue;
+        }
+        if(status == DroidStatus::MovedAndFoundSystem) {
+          e.oxygenSystem = to;
+          e.movesToOxygenSystem = distance;
+        }
+        e.screen.set(to, status == DroidStatus::Moved ? Tile::Empty : Tile::OxygenSystem);
+        moved.outputs.clear();
+        next.push_back({move(moved), to});
+      }
+    }
+    frontier = move(next);
+  }
+  return e;
+}
+
+// Minutes for the oxygen to reach every open position of the map
+int oxygenFillTime(const Screen &screen, const Coordinate &oxygenSystem) {
+  Screen filled;
+  filled.set(oxygenSystem, Tile::OxygenSystem);
+  vector<Coordinate> front {oxygenSystem};
+  int minutes = -1;
+  for(; !front.empty(); minutes++) {
+    vector<Coordinate> next;
+    for(const Coordinate &c : front) {
+      for(const Coordinate &offset : moveOffsets) {
+        const Coordinate to = c + offset;
+        if(screen.at(to) == Tile::Empty && filled.at(to) == Tile::Unknown) {
+          filled.set(to, Tile::OxygenSystem);
+          next.push_back(to);
+        }
+      }
+    }
+    front = move(next);
+  }
+  return minutes;
+}
+
+// Moves are read as 1 to 4, type save to checkpoint the droid
+void driveManually(const string &checkpointPath) {
+  IntcodeVM droid = ifstream(checkpointPath).good()
+    ? loadIntcodeCheckpoint(checkpointPath)
+    : IntcodeVM(parseIntcode(getPuzzleInput("inputs/aoc_day15_1.txt").front()));
+  droid.resume();
   string instruction;
-  while(!droid.terminated) {
-    getline(cin, instruction);
+  while(!droid.terminated && getline(cin, instruction)) {
+    if(instruction == "save") {
+      saveIntcodeCheckpoint(droid, checkpointPath);
+      cout << "Checkpoint saved to " << checkpointPath << "\n";
+      continue;
+    }
+    droid.inputs.push(atoi(instruction.c_str()));
     droid.outputs.clear();
-    droid = runProgram(droid);
+    droid.resume();
+    cout << droid.outputs << "\n";
   }
+}
+
+int main(int argc, char const *argv[]){
+  // Optional argument: checkpoint file, the droid is then driven from stdin
+  // and restored from that file when it exists
+  if(argc > 1) {
+    driveManually(argv[1]);
+    return 0;
+  }
+
+  const auto program = parseIntcode(getPuzzleInput("inputs/aoc_day15_1.txt").front());
+  const auto start = chrono::steady_clock::now();
+  const Exploration e = explore<IntcodeVM>(program);
+  const auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+  // Same search on an interpreted VM counting what the droids executed
+  const Exploration counted = explore<CountedIntcodeVM>(program);
+  assert(counted.droidMoves == e.droidMoves && screenToString(counted.screen) == screenToString(e.screen));
+
+  cout << screenToString(e.screen);
+  cout << "Part1, fewest moves to the oxygen system: " << e.movesToOxygenSystem << "\n";
+  cout << "Part2, minutes to fill the area with oxygen: " << oxygenFillTime(e.screen, e.oxygenSystem) << "\n";
+  cerr << "Map discovered in " << micros << "us: " << e.droidMoves << " droid moves, "
+       << counted.instructions << " VM instructions\n";
 
   return 0;
 }
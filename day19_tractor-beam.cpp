@@ -1,63 +1,246 @@
 #include <iostream>
 #include <cassert>
+#include <optional>
+#include <functional>
+#include <map>
 #include "IntcodeComputer.cpp"
+#include "IntcodeBatch.cpp"
+#include "IntcodeMemo.cpp"
+// Native code from intcode-aot, when it has been generated
+#if __has_include("aot/aoc_day19_1.cpp")
+#include "aot/aoc_day19_1.cpp"
+#endif
+
+// First and last x pulled on a row, left > right when the row is empty
+struct BeamRow
+{
+  IntCode left;
+  IntCode right;
+  bool empty() const { return left > right; }
+};
+
+// Smallest x in [lowest, known] where inside holds, inside being false below
+// that edge and true from it up to known: gallops from guess then bisects
+template<typename Inside>
+IntCode gallopEdge(Inside inside, IntCode guess, IntCode lowest, IntCode known) {
+  guess = clamp(guess, lowest, known);
+  IntCode in = guess, out = guess;
+  if(inside(guess)) {
+    for(IntCode step = 1; ; step *= 2) {
+      out = in - step;
+      if(out < lowest) {
+        out = lowest - 1;
+        break;
+      }
+      if(!inside(out)) {
+        break;
+      }
+      in = out;
+    }
+  }
+  else {
+    for(IntCode step = 1; ; step *= 2) {
+      in = min(out + step, known);
+      if(in == known || inside(in)) {
+        break;
+      }
+      out = in;
+    }
+  }
+  while(in - out > 1) {
+    const IntCode middle = out + (in - out) / 2;
+    (inside(middle) ? in : out) = middle;
+  }
+  return in;
+}
+
+// Follows the edges of the beam, a cone from the emitter: every row is an
+// interval whose edges only move right going down. The next row is found from
+// the previous one in a couple of probes, a far row from the slopes of the
+// nearest known one, galloping from that estimate to the edges.
+class BeamEdges
+{
+public:
+  BeamEdges(function<bool(IntCode, IntCode)> inBeam, IntCode scanWidth) : inBeam(inBeam), scanWidth(scanWidth) {}
+
+  BeamRow row(IntCode y) {
+    const auto known = rows.find(y);
+    if(known != rows.end()) {
+      return known->second;
+    }
+    const auto reference = nearestPulled(y);
+    if(!reference) {
+      // Rows near the emitter can be empty, they are scanned down to the
+      // first pulled one
+      for(IntCode r = 0; r < y && !nearestPulled(y); r++) {
+        rows.emplace(r, scan(r));
+      }
+      return nearestPulled(y) ? row(y) : rows[y] = scan(y);
+    }
+    if(rows.count(y - 1) || reference->first == y - 1) {
+      return rows[y] = next(y, reference->first, reference->second);
+    }
+    const auto far = fromSlopes(y, reference->first, reference->second);
+    return rows[y] = far ? *far : walk(y, reference->first);
+  }
+
+private:
+  function<bool(IntCode, IntCode)> inBeam;
+  IntCode scanWidth;
+  map<IntCode, BeamRow> rows;
+
+  // Closest row below the emitter with pulled points, one below y preferred
+  optional<pair<IntCode, BeamRow>> nearestPulled(IntCode y) const {
+    auto it = rows.lower_bound(y);
+    for(auto below = make_reverse_iterator(it); below != rows.rend(); below++) {
+      if(below->first > 0 && !below->second.empty()) {
+        return *below;
+      }
+    }
+    for(; it != rows.end(); it++) {
+      if(it->first > 0 && !it->second.empty()) {
+        return *it;
+      }
+    }
+    return nullopt;
+  }
+
+  // Row y from its first scanWidth points, or up to its right edge
+  BeamRow scan(IntCode y) {
+    BeamRow found {1, 0};
+    for(IntCode x = 0; x < scanWidth || !found.empty(); x++) {
+      if(inBeam(x, y)) {
+        found.left = found.empty() ? x : found.left;
+        found.right = x;
+      }
+      else if(!found.empty()) {
+        break;
+      }
+    }
+    return found;
+  }
+
+  // Row y from the pulled row ry above it, no further right than its slope
+  BeamRow next(IntCode y, IntCode ry, BeamRow above) {
+    const IntCode limit = (above.right + 1) * y / ry + 1;
+    IntCode left = above.left;
+    while(left <= limit && !inBeam(left, y)) {
+      left++;
+    }
+    if(left > limit) {
+      return {1, 0};
+    }
+    IntCode right = max(left, above.right);
+    while(inBeam(right + 1, y)) {
+      right++;
+    }
+    return {left, right};
+  }
+
+  // Row y at the slopes of row ry, when the middle of the estimate is pulled
+  optional<BeamRow> fromSlopes(IntCode y, IntCode ry, BeamRow reference) {
+    const IntCode middle = (reference.left + reference.right) * y / (2 * ry);
+    if(!inBeam(middle, y)) {
+      return nullopt;
+    }
+    const IntCode left = gallopEdge([&](IntCode x) { return inBeam(x, y); }, reference.left * y / ry, 0, middle);
+    const IntCode right = -gallopEdge([&](IntCode x) { return inBeam(-x, y); }, -(reference.right * y / ry),
+      numeric_limits<IntCode>::min() / 4, -middle);
+    return BeamRow {left, right};
+  }
+
+  // Row by row down to y, when the estimate missed the beam
+  BeamRow walk(IntCode y, IntCode from) {
+    for(IntCode r = from + 1; r < y; r++) {
+      row(r);
+    }
+    return row(y);
+  }
+};
+
+// Top left corner of the first size x size square fitting in the beam
+// closest to the emitter. Whether a square fits with its bottom on row y only
+// depends on two rows, the first fitting row is galloped then bisected.
+pair<IntCode, IntCode> closestSquare(BeamEdges &beam, IntCode size) {
+  const auto fits = [&](IntCode y) {
+    const BeamRow bottom = beam.row(y), top = beam.row(y - size + 1);
+    return !bottom.empty() && !top.empty() && top.left <= bottom.left
+      && bottom.left + size - 1 <= min(top.right, bottom.right);
+  };
+  IntCode fitting = size - 1, tooHigh = size - 2;
+  for(IntCode step = size; !fits(fitting); step *= 2) {
+    tooHigh = fitting;
+    fitting += step;
+  }
+  while(fitting - tooHigh > 1) {
+    const IntCode middle = tooHigh + (fitting - tooHigh) / 2;
+    (fits(middle) ? fitting : tooHigh) = middle;
+  }
+  // Edges are jagged by a point, a few rows above the bisected one can fit
+  // too: as many as it takes the gap between the edges to grow by two
+  const BeamRow bottom = beam.row(fitting);
+  const IntCode jagged = min(fitting - size + 1, 2 * fitting / max<IntCode>(bottom.right - bottom.left, 1) + 1);
+  for(IntCode y = fitting - jagged; y < fitting; y++) {
+    if(fits(y)) {
+      fitting = y;
+      break;
+    }
+  }
+  return {beam.row(fitting).left, fitting - size + 1};
+}
 
 int main(int argc, char const *argv[])
 {
+  testIntcodeMemo();
+
   // Part 1
   const auto droneProgram = parseIntcode(getPuzzleInput("inputs/aoc_day19_1.txt").front());
 
+  // Optional arguments: file keeping the probes across runs, side of the part 2
+  // square. The beam edges never probe a point twice, the probes only hit the
+  // cache when a later run (another square size...) loads them from the file.
+  IntcodeResultCache probeCache(1 << 16, argc > 1 ? argv[1] : "");
+  MemoizedProgram drone(droneProgram, probeCache);
+  const IntCode squareSize = argc > 2 ? stoll(argv[2]) : 100;
+
   const auto inBeam = [&](IntCode x, IntCode y) {
-    const queue<IntCode> droneInput({x, y});
-    const auto drone = runProgram(droneProgram, droneInput);
-    const bool isPulled = drone.outputs.back() == 1;
-    assert(drone.terminated);
-    return isPulled;
+    return drone.run({x, y}).back() == 1;
   };
+  BeamEdges beam(inBeam, 50);
 
+  // Rows of the 50x50 area from the beam edges
   size_t tractorBeamAffeted = 0;
+  for(IntCode y = 0; y < 50; y++) {
+    const BeamRow r = beam.row(y);
+    if(!r.empty() && r.left >= 50) {
+      break;
+    }
+    if(!r.empty()) {
+      tractorBeamAffeted += min<IntCode>(r.right, 49) - r.left + 1;
+    }
+  }
+  cout << "Part1, coordinate affected by the tractor beam: " << tractorBeamAffeted << "\n";
+
+  // The whole area, run as a lockstep batch, must agree
+  vector<BatchRun> scan;
   for (int x = 0; x < 50; x++)
   {
     for (int y = 0; y < 50; y++)
     {
-      if(inBeam(x, y)) {
-        tractorBeamAffeted++;
-      }
+      scan.push_back({{}, {x, y}});
     }
   }
-  cout << "Part1, coordinate affected by the tractor beam: " << tractorBeamAffeted << "\n";
+  const auto scanResults = runBatch(droneProgram, scan);
+  assert(tractorBeamAffeted == size_t(count_if(scanResults.cbegin(), scanResults.cend(), [](const BatchResult &r) {
+    return r.terminated && r.outputs.back() == 1;
+  })));
+  const size_t part1Runs = probeCache.misses, part1Hits = probeCache.hits;
 
   // Part 2
-  bool search = true;
-  int maxY = 0;
-  int previousMinX = 0;
-  while(search) {
+  const auto [squareX, squareY] = closestSquare(beam, squareSize);
+  cout << "Part2: " << squareX * 10000 + squareY << "\n";
+  cout << "Part1 probes: " << part1Hits << " cached, " << part1Runs << " run\n";
+  cout << "Part2 probes: " << probeCache.hits - part1Hits << " cached, " << probeCache.misses - part1Runs << " run\n";
 
-    int x = previousMinX;
-    optional<int> minX;
-    while(!minX.has_value()) {
-      if(!minX.has_value() && inBeam(x, maxY)) {
-        minX = x;
-      }
-      else {
-        x++;
-      }
-    }
-
-    const bool bottomRightInBeam = inBeam(minX.value() + 99, maxY);
-    if(bottomRightInBeam) {
-      const bool topLeftInBeam = inBeam(minX.value(), maxY - 99);
-      const bool topRightInBeam = inBeam(minX.value() + 99, maxY - 99);
-      if(topLeftInBeam && topRightInBeam) {
-        cout << "Part2: " << minX.value() * 10000 + (maxY - 99) << "\n";
-        search = false;
-      }
-    }
-
-    previousMinX = minX.value();
-    maxY++;
-  }
-  
   return 0;
 }
-
@@ -1,6 +1,12 @@
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <map>
+#include <deque>
+#include <unordered_set>
+#include <sstream>
 #include "IntcodeComputer.cpp"
+#include "threadpool.cpp"
 
 void pushSpringscriptInput(ProgramState &droid, const vector<string> &instructions) {
   if(instructions.size() > 15) {
@@ -23,6 +29,323 @@ string asciiToString(const vector<IntCode> &ascii) {
   return str;
 }
 
+// Springscript registers: sensors A to I then T and J
+const string springRegisters = "ABCDEFGHITJ";
+constexpr int temporaryRegister = 9;
+constexpr int jumpRegister = 10;
+
+struct SpringInstruction
+{
+  enum Operation {And, Or, Not} operation;
+  int source;
+  int target;
+};
+
+string springText(const SpringInstruction &i) {
+  return string(i.operation == SpringInstruction::And ? "AND " : i.operation == SpringInstruction::Or ? "OR " : "NOT ")
+    + springRegisters[i.source] + " " + springRegisters[i.target];
+}
+
+// Hull segment the droid fell in, as the VM drew it under the droid
+string failingHull(const string &output) {
+  istringstream lines(output);
+  string line;
+  while(getline(lines, line)) {
+    if(line.find('#') != string::npos && line.find_first_not_of("#.") == string::npos) {
+      return line;
+    }
+  }
+  cerr << "No hull in the springdroid output:\n" << output << "\n";
+  throw;
+}
+
+constexpr size_t maxSpringscriptInstructions = 15;
+// Sensor patterns the simulator handles, one bit each in a register column
+constexpr size_t maxSpringPatterns = 512;
+
+// Runs springscripts natively against the hulls the droid fell in: every
+// register is a column holding its value for all the sensor patterns at
+// once, an instruction is a few word operations and the droid walks a hull
+// looking up its jump decision per pattern
+class SpringSimulator
+{
+public:
+  SpringSimulator(const vector<string> &hulls, int sensorCount) : sensorCount(sensorCount) {
+    map<unsigned, size_t> patternIndex;
+    for(const string &hull : hulls) {
+      // Only the positions the droid can reach and still make it across from
+      // get a pattern, their jump decisions are the only ones that matter
+      const auto ground = [&](size_t p) { return p >= hull.size() || hull[p] == '#'; };
+      vector<bool> crossable(hull.size() + 4, true), reachable(hull.size(), false);
+      for(size_t p = hull.size(); p-- > 0; ) {
+        crossable[p] = ground(p) && ((ground(p + 1) && crossable[p + 1]) || (ground(p + 4) && crossable[p + 4]));
+      }
+      reachable[0] = true;
+      vector<size_t> positions(hull.size(), deadPosition);
+      for(size_t p = 0; p < hull.size(); p++) {
+        if(!reachable[p] || !crossable[p]) {
+          continue;
+        }
+        for(const size_t next : {p + 1, p + 4}) {
+          if(next < hull.size()) {
+            reachable[next] = true;
+          }
+        }
+        unsigned pattern = 0;
+        for(int s = 0; s < sensorCount; s++) {
+          pattern |= unsigned(ground(p + s + 1)) << s;
+        }
+        positions[p] = patternIndex.emplace(pattern, patternIndex.size()).first->second;
+      }
+      walks.push_back({hull, positions});
+    }
+    for(const auto &[pattern, index] : patternIndex) {
+      for(int s = 0; s < sensorCount; s++) {
+        sensorColumns[s][index / 64] |= uint64_t(pattern >> s & 1) << (index % 64);
+      }
+      valid[index / 64] |= uint64_t(1) << (index % 64);
+    }
+    columnWords = max<size_t>((patternIndex.size() + 63) / 64, 1);
+  }
+
+  int sensors() const { return sensorCount; }
+  size_t words() const { return columnWords; }
+
+  // T and J after one instruction, on the first Words words of the columns
+  template<size_t Words>
+  void execute(const SpringInstruction &i, array<uint64_t, Words> &t, array<uint64_t, Words> &j) const {
+    array<uint64_t, Words> &target = i.target == temporaryRegister ? t : j;
+    for(size_t w = 0; w < Words; w++) {
+      const uint64_t source = i.source == temporaryRegister ? t[w] : i.source == jumpRegister ? j[w] : sensorColumns[i.source][w];
+      target[w] = i.operation == SpringInstruction::And ? source & target[w]
+        : i.operation == SpringInstruction::Or ? source | target[w]
+        : ~source & valid[w];
+    }
+  }
+
+  // True when the droid jumping where j says makes it across every hull
+  bool crosses(const uint64_t *j) const {
+    for(const auto &[hull, positions] : walks) {
+      for(size_t p = 0; p < hull.size(); ) {
+        if(positions[p] == deadPosition) {
+          return false;
+        }
+        p += j[positions[p] / 64] >> (positions[p] % 64) & 1 ? 4 : 1;
+      }
+    }
+    return true;
+  }
+
+private:
+  static constexpr size_t deadPosition = numeric_limits<size_t>::max();
+  using Column = array<uint64_t, maxSpringPatterns / 64>;
+  int sensorCount;
+  size_t columnWords = 1;
+  array<Column, 9> sensorColumns {};
+  Column valid {};
+  vector<pair<string, vector<size_t>>> walks;
+};
+
+// Search node: the T and J columns a script reaches, the node of the script
+// without its last instruction and that instruction
+template<size_t Words>
+struct SpringNode
+{
+  array<uint64_t, Words> t;
+  array<uint64_t, Words> j;
+  uint32_t parent;
+  uint8_t instruction;
+
+  size_t hash() const {
+    size_t h = 0;
+    for(size_t w = 0; w < Words; w++) {
+      h = ((h ^ t[w]) * 0x100000001b3 ^ j[w]) * 0x9e3779b97f4a7c15;
+    }
+    return h ^ h >> 29;
+  }
+  bool sameColumns(const SpringNode &other) const { return t == other.t && j == other.j; }
+};
+
+// Open addressing set of indexes into a node vector, looked up by the columns
+// of nodes not stored yet. Lookups are safe from several threads between
+// inserts.
+template<typename Node>
+class SpringNodeSet
+{
+public:
+  bool contains(const vector<Node> &nodes, const Node &node) const {
+    for(size_t slot = node.hash() & (slots.size() - 1); slots[slot] != empty; slot = (slot + 1) & (slots.size() - 1)) {
+      if(nodes[slots[slot]].sameColumns(node)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // False when the columns of nodes[index] were already in
+  bool insert(const vector<Node> &nodes, uint32_t index) {
+    if(contains(nodes, nodes[index])) {
+      return false;
+    }
+    if(++count * 2 > slots.size()) {
+      vector<uint32_t> previous(slots.size() * 2, empty);
+      swap(previous, slots);
+      for(const uint32_t stored : previous) {
+        if(stored != empty) {
+          place(nodes, stored);
+        }
+      }
+    }
+    place(nodes, index);
+    return true;
+  }
+
+private:
+  static constexpr uint32_t empty = numeric_limits<uint32_t>::max();
+  vector<uint32_t> slots = vector<uint32_t>(1024, empty);
+  size_t count = 0;
+
+  void place(const vector<Node> &nodes, uint32_t index) {
+    size_t slot = nodes[index].hash() & (slots.size() - 1);
+    while(slots[slot] != empty) {
+      slot = (slot + 1) & (slots.size() - 1);
+    }
+    slots[slot] = index;
+  }
+};
+
+// Shortest springscripts crossing every known hull, at most count of them,
+// breadth first over the T and J columns reached, a level at a time on the
+// pool: scripts reaching the same columns as a shorter or earlier one are not
+// extended. evaluated counts the scripts run on the simulator.
+template<size_t Words>
+vector<vector<SpringInstruction>> shortestSpringscripts(const SpringSimulator &simulator, size_t count, ThreadPool &pool, size_t &evaluated) {
+  using Node = SpringNode<Words>;
+  vector<SpringInstruction> instructions;
+  for(const auto operation : {SpringInstruction::And, SpringInstruction::Or, SpringInstruction::Not}) {
+    for(int source = 0; source <= jumpRegister; source++) {
+      if(source < temporaryRegister && source >= simulator.sensors()) {
+        continue;
+      }
+      instructions.push_back({operation, source, temporaryRegister});
+      instructions.push_back({operation, source, jumpRegister});
+    }
+  }
+
+  vector<Node> nodes {{{}, {}, 0, 0}};
+  SpringNodeSet<Node> seen;
+  seen.insert(nodes, 0);
+  const auto script = [&](const Node &last) {
+    vector<SpringInstruction> found {instructions[last.instruction]};
+    for(size_t n = last.parent; n != 0; n = nodes[n].parent) {
+      found.push_back(instructions[nodes[n].instruction]);
+    }
+    return vector<SpringInstruction>(found.rbegin(), found.rend());
+  };
+  if(simulator.crosses(nodes[0].j.data())) {
+    return {{}};
+  }
+  vector<uint8_t> everyInstruction, changingJ;
+  for(size_t i = 0; i < instructions.size(); i++) {
+    everyInstruction.push_back(i);
+    if(instructions[i].target == jumpRegister) {
+      changingJ.push_back(i);
+    }
+  }
+
+  // Chunks only read the nodes stored before a level, what they find is
+  // merged in chunk order so the scripts do not depend on timing
+  const auto expand = [&](size_t begin, size_t end, const vector<uint8_t> &candidates, auto visit) {
+    mutex chunksLock;
+    map<size_t, vector<Node>> chunks;
+    atomic<size_t> tried {0};
+    parallelChunks(pool, end - begin, [&](size_t first, size_t last) {
+      vector<Node> kept;
+      SpringNodeSet<Node> keptColumns;
+      size_t chunkTried = 0;
+      for(size_t n = begin + first; n < begin + last && visit(first, kept, keptColumns, nullptr); n++) {
+        for(const uint8_t i : candidates) {
+          Node next {nodes[n].t, nodes[n].j, uint32_t(n), i};
+          simulator.execute(instructions[i], next.t, next.j);
+          chunkTried++;
+          if(!visit(first, kept, keptColumns, &next)) {
+            break;
+          }
+        }
+      }
+      tried += chunkTried;
+      lock_guard<mutex> lock(chunksLock);
+      chunks[first] = move(kept);
+    });
+    evaluated += tried;
+    return chunks;
+  };
+
+  for(size_t depth = 1, begin = 0, end = 1; depth <= maxSpringscriptInstructions && begin < end; depth++) {
+    // Only scripts changing J may cross where their prefix did not, checked
+    // before storing the level: the last one is never stored. NOT of a sensor
+    // into J forgets the prefix, the script of that single instruction was
+    // tried first.
+    atomic<size_t> filledChunk {numeric_limits<size_t>::max()};
+    if(depth == 2) {
+      changingJ.erase(remove_if(changingJ.begin(), changingJ.end(), [&](uint8_t i) {
+        return instructions[i].operation == SpringInstruction::Not && instructions[i].source < temporaryRegister;
+      }), changingJ.end());
+    }
+    const auto crossing = expand(begin, end, changingJ, [&](size_t first, vector<Node> &kept, SpringNodeSet<Node> &, const Node *next) {
+      if(!next) {
+        return first < filledChunk && kept.size() < count;
+      }
+      if(next->j != nodes[next->parent].j && simulator.crosses(next->j.data())) {
+        kept.push_back(*next);
+        if(kept.size() == count) {
+          size_t known = filledChunk;
+          while(first < known && !filledChunk.compare_exchange_weak(known, first));
+          return false;
+        }
+      }
+      return true;
+    });
+    vector<vector<SpringInstruction>> scripts;
+    for(const auto &[first, kept] : crossing) {
+      for(size_t k = 0; k < kept.size() && scripts.size() < count; k++) {
+        scripts.push_back(script(kept[k]));
+      }
+    }
+    if(!scripts.empty()) {
+      return scripts;
+    }
+
+    const auto reached = expand(begin, end, everyInstruction, [&](size_t, vector<Node> &kept, SpringNodeSet<Node> &keptColumns, const Node *next) {
+      if(next && !seen.contains(nodes, *next) && !keptColumns.contains(kept, *next)) {
+        kept.push_back(*next);
+        keptColumns.insert(kept, kept.size() - 1);
+      }
+      return true;
+    });
+    for(const auto &[first, kept] : reached) {
+      for(const Node &node : kept) {
+        nodes.push_back(node);
+        if(!seen.insert(nodes, nodes.size() - 1)) {
+          nodes.pop_back();
+        }
+      }
+    }
+    begin = end;
+    end = nodes.size();
+  }
+  return {};
+}
+
+vector<vector<SpringInstruction>> shortestSpringscripts(const SpringSimulator &simulator, size_t count, ThreadPool &pool, size_t &evaluated) {
+  switch(simulator.words()) {
+    case 1: return shortestSpringscripts<1>(simulator, count, pool, evaluated);
+    case 2: return shortestSpringscripts<2>(simulator, count, pool, evaluated);
+    case 3: case 4: return shortestSpringscripts<4>(simulator, count, pool, evaluated);
+    default: return shortestSpringscripts<8>(simulator, count, pool, evaluated);
+  }
+}
+
 const vector<string> walkSpringscript {
   // Hole incoming
   "NOT A T",
@@ -52,6 +375,57 @@ const vector<string> runSpringscript {
   "RUN"
 };
 
+struct SpringSynthesis
+{
+  vector<SpringInstruction> script;
+  IntCode hullDamage;
+  size_t hulls;
+  size_t vmRuns;
+  size_t evaluated;
+};
+
+// Shortest script the springdroid makes it across with, synthesized against
+// the hulls it fell in so far: only scripts crossing them all are sent to the
+// VM, a few of the shortest at a time. The VM either reports the damage or
+// shows the hull the droid fell in.
+SpringSynthesis synthesizeSpringscript(const vector<IntCode> &springdroidProgram, const string &mode, ThreadPool &pool) {
+  constexpr size_t candidatesPerRound = 32;
+  vector<string> hulls;
+  size_t vmRuns = 0;
+  size_t evaluated = 0;
+  while(true) {
+    const SpringSimulator simulator(hulls, mode == "WALK" ? 4 : 9);
+    const auto scripts = shortestSpringscripts(simulator, candidatesPerRound, pool, evaluated);
+    if(scripts.empty()) {
+      cerr << "No springscript of " << maxSpringscriptInstructions << " instructions crosses the " << hulls.size() << " hulls\n";
+      throw;
+    }
+    const size_t knownHulls = hulls.size();
+    for(const auto &script : scripts) {
+      vector<string> lines;
+      for(const SpringInstruction &instruction : script) {
+        lines.push_back(springText(instruction));
+      }
+      lines.push_back(mode);
+      auto springdroid = runProgram(springdroidProgram);
+      pushSpringscriptInput(springdroid, lines);
+      springdroid = runProgram(springdroid);
+      vmRuns++;
+      if(springdroid.outputs.back() > 127) {
+        return {script, springdroid.outputs.back(), hulls.size(), vmRuns, evaluated};
+      }
+      const string hull = failingHull(asciiToString(springdroid.outputs));
+      if(find(hulls.cbegin(), hulls.cbegin() + knownHulls, hull) != hulls.cbegin() + knownHulls) {
+        cerr << "The droid fell in a hull the simulator crossed: " << hull << "\n";
+        throw;
+      }
+      if(find(hulls.cbegin(), hulls.cend(), hull) == hulls.cend()) {
+        hulls.push_back(hull);
+      }
+    }
+  }
+}
+
 int main(int argc, char const *argv[])
 {
   // Part 1
@@ -73,5 +447,26 @@ int main(int argc, char const *argv[])
   // cout << asciiToString(springdroid2.outputs) << "\n";
   cout << "Part2, hull damage: " << springdroid2.outputs.back() << "\n";
 
+  // Optional arguments: "synthesize" to run both parts again with the
+  // shortest scripts found, several seconds for RUN, then the worker thread
+  // count of the search
+  if(argc < 2 || string(argv[1]) != "synthesize") {
+    return 0;
+  }
+  ThreadPool pool(argc > 2 ? stoul(argv[2]) : thread::hardware_concurrency());
+  for(const auto &[mode, damage] : {make_pair("WALK", springdroid.outputs.back()), make_pair("RUN", springdroid2.outputs.back())}) {
+    const auto start = chrono::steady_clock::now();
+    const SpringSynthesis synthesis = synthesizeSpringscript(springdroidProgram, mode, pool);
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    assert(synthesis.hullDamage == damage);
+    cout << mode << " shortest springscript, " << synthesis.script.size() << " instructions:";
+    for(const SpringInstruction &instruction : synthesis.script) {
+      cout << " " << springText(instruction) << ";";
+    }
+    cout << "\n";
+    cerr << mode << ": " << synthesis.hulls << " hulls, " << synthesis.vmRuns << " VM runs, " << synthesis.evaluated << " scripts simulated in "
+         << elapsed.count() << "s (" << size_t(synthesis.evaluated / elapsed.count()) << " scripts/s)\n";
+  }
+
   return 0;
 }
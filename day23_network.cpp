@@ -1,7 +1,10 @@
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <deque>
 #include <optional>
 #include "IntcodeComputer.cpp"
+#include "threadpool.cpp"
 
 struct Packet {
   IntCode x {0};
@@ -13,75 +16,405 @@ ostream &operator<<(ostream &os, const Packet &p) {
   return os;
 }
 
-int main(int argc, char const *argv[])
+// Counts the writes that changed a cell value
+struct ChangedWriteCounter
 {
-  // Part 1
-  const auto nicProgram = parseIntcode(getPuzzleInput("inputs/aoc_day23_1.txt").front());
-  ProgramState computers[50];
-  for (int ip = 0; ip < 50; ip++){
-    const queue<IntCode> networkAdress({ip});
-    computers[ip] = runProgram(nicProgram, networkAdress);
-  }
-
-  queue<Packet> packetQueues[50];
-  optional<Packet> lastNATPacket;
-  size_t cycleCount = 0;
-  while(true) {
-    bool allIdle = true;
-
-    // Collect packets
-    size_t packetSent = 0;
-    for (size_t ip = 0; ip < 50; ip++){
-      auto &currentComputer = computers[ip];
-      for (size_t n = 0; n < currentComputer.outputs.size(); n+=3) {
-        const auto address = currentComputer.outputs.at(n);
-        const Packet p {currentComputer.outputs.at(n+1), currentComputer.outputs.at(n+2)};
-        if(address == 255) {
-          lastNATPacket = p;
-          // cerr << ip << " sent a NAT packet " << p << "\n";
-        }
-        else if(address < 50) {
-          allIdle = false;
-          packetQueues[address].push(p);
-          // cout << ip << " sent a packet" << p << " to " << address << "\n";
+  size_t changedWrites = 0;
+  void onInstruction(size_t, DecodedInstruction) {}
+  void onOperands(IntCode, IntCode) {}
+  void onInputStarved(size_t) {}
+  void onMemoryGrowth(size_t) {}
+  void onMemoryWrite(size_t, IntCode previous, IntCode value) { changedWrites += previous != value; }
+  void onFault() {}
+};
+
+using NicVM = BasicIntcodeVM<ChangedWriteCounter>;
+
+constexpr IntCode natAddress = 255;
+// The NIC program only knows 50 addresses, bigger networks are made of
+// segments of 50 NICs with their own NAT, addresses are local to a segment
+constexpr size_t segmentSize = 50;
+
+// Runs a NIC until it waits for input again, with an empty poll (-1) when it
+// has none. An empty poll that sends nothing and leaves the memory,
+// instruction pointer and relative base as they were is a fixed point:
+// polling again would do the same forever. True when the NIC must be parked,
+// at such a fixed point or halted. packetsSent is the counter its sink bumps.
+bool runNic(NicVM &nic, const size_t &packetsSent, size_t &polls) {
+  const bool polling = nic.inputs.empty();
+  if(polling) {
+    nic.inputs.push(-1);
+    polls++;
+  }
+  const size_t instructionPointer = nic.getInstructionPointer();
+  const IntCode relativeBase = nic.getRelativeBase();
+  const size_t sentBefore = packetsSent;
+  nic.instrumentation.changedWrites = 0;
+  nic.resume();
+
+  const bool fixedPoint = polling && packetsSent == sentBefore && nic.instrumentation.changedWrites == 0
+    && nic.getInstructionPointer() == instructionPointer && nic.getRelativeBase() == relativeBase;
+  return nic.terminated || fixedPoint;
+}
+
+// NAT of every segment, woken up each time the whole network is idle
+class NatMonitor
+{
+public:
+  optional<IntCode> firstNatY {};
+  size_t wakeUps = 0;
+
+  explicit NatMonitor(size_t segments) : packets(segments), lastWakeUpY(segments) {}
+
+  void receive(size_t segment, const Packet &p) {
+    lock_guard<mutex> lock(packetsLock);
+    packets[segment] = p;
+    if(segment == 0 && !firstNatY.has_value()) {
+      firstNatY = p.y;
+    }
+  }
+
+  // Sends the last packet of every NAT to NIC 0 of its segment, unless every
+  // NAT would send the same Y twice in a row: returns the Y of the first one then
+  template<typename Deliver>
+  optional<IntCode> wakeUp(Deliver deliver) {
+    lock_guard<mutex> lock(packetsLock);
+    bool repeated = true;
+    for(size_t segment = 0; segment < packets.size(); segment++) {
+      if(!packets[segment].has_value()) {
+        cerr << "The network is idle and the NAT of segment " << segment << " has no packet to send\n";
+        throw;
+      }
+      repeated &= lastWakeUpY[segment] == packets[segment]->y;
+    }
+    if(repeated) {
+      return packets[0]->y;
+    }
+    cout << "The network is idle, sending last NAT packet " << packets[0].value() << " to 0\n";
+    wakeUps++;
+    for(size_t segment = 0; segment < packets.size(); segment++) {
+      lastWakeUpY[segment] = packets[segment]->y;
+      deliver(segment * segmentSize, packets[segment].value());
+    }
+    return nullopt;
+  }
+
+private:
+  vector<optional<Packet>> packets;
+  vector<optional<IntCode>> lastWakeUpY;
+  mutex packetsLock;
+};
+
+// Sends on the network, the destination is local to the sender's segment
+template<typename Deliver>
+void route(NatMonitor &nat, size_t from, IntCode address, const Packet &p, Deliver deliver) {
+  const size_t segment = from / segmentSize;
+  if(address == natAddress) {
+    nat.receive(segment, p);
+  }
+  else if(address >= 0 && static_cast<size_t>(address) < segmentSize) {
+    deliver(segment * segmentSize + address, p);
+  }
+  else {
+    cerr << "Tried to sent a packet " << p << " to an invalid adress " << address << "\n";
+    throw;
+  }
+}
+
+// Calls send(from, destination, packet) each time the NIC outputs a packet
+template<typename Send>
+void setPacketSink(NicVM &nic, size_t from, Send send) {
+  nic.setOutputSink([=, pending = vector<IntCode>()](IntCode value) mutable {
+    pending.push_back(value);
+    if(pending.size() == 3) {
+      send(from, pending[0], Packet {pending[1], pending[2]});
+      pending.clear();
+    }
+  });
+}
+
+// Event driven network: only the NICs in the ready queue are run, the others
+// are parked until a packet arrives. The network is idle exactly when every
+// NIC is parked.
+class Network
+{
+public:
+  size_t packetsSent = 0;
+  size_t polls = 0;
+  NatMonitor nat;
+
+  Network(const vector<IntCode> &nicProgram, size_t nicCount) : nat(nicCount / segmentSize), parked(nicCount, false) {
+    const NicVM booted(nicProgram);
+    nics.reserve(nicCount);
+    for(size_t address = 0; address < nicCount; address++) {
+      nics.push_back(booted.fork());
+      nics.back().inputs.push(address % segmentSize);
+      setPacketSink(nics.back(), address, [this](size_t from, IntCode to, const Packet &p) {
+        packetsSent++;
+        route(nat, from, to, p, [this](size_t address, const Packet &p) { deliver(address, p); });
+      });
+      ready.push_back(address);
+    }
+  }
+
+  // Runs until the NATs wake the network up with the same Y twice in a row,
+  // returns the Y of the first segment
+  IntCode run() {
+    while(true) {
+      while(!ready.empty()) {
+        const size_t address = ready.front();
+        ready.pop_front();
+        if(runNic(nics[address], packetsSent, polls)) {
+          parked[address] = true;
+        } else {
+          ready.push_back(address);
         }
-        else {
-          cerr << ip << " tried to sent a packet " << p << " to an invalid adress " << address << "\n";
-          throw;
+      }
+      if(const auto repeatedY = nat.wakeUp([this](size_t address, const Packet &p) { deliver(address, p); })) {
+        return repeatedY.value();
+      }
+    }
+  }
+
+private:
+  vector<NicVM> nics {};
+  vector<bool> parked;
+  deque<size_t> ready {};
+
+  void deliver(size_t address, const Packet &p) {
+    nics[address].inputs.push(p.x);
+    nics[address].inputs.push(p.y);
+    if(parked[address]) {
+      parked[address] = false;
+      ready.push_back(address);
+    }
+  }
+};
+
+// Same network with the NICs spread over the workers of a pool, NIC a is run
+// by worker a % workers. Packets between workers go through one lock-free
+// single producer single consumer ring per (sender, receiver) pair, the
+// coordinator (the thread calling run) has its own rings to send the NAT
+// wake-ups.
+//
+// Quiescence: a packet is counted as sent before it is pushed and as received
+// after it is delivered, and a worker only flags itself idle once it has no
+// ready NIC left. A worker leaving idleness clears its flag, then bumps its
+// epoch before counting what it received. The network is idle when every
+// worker is idle and every sent packet was received, with no epoch change
+// around those reads: a packet still in flight keeps the counts apart, a
+// worker seen idle then woken up before the counts were read changes the
+// epochs.
+class ThreadedNetwork
+{
+public:
+  NatMonitor nat;
+
+  ThreadedNetwork(const vector<IntCode> &nicProgram, size_t nicCount, ThreadPool &pool)
+    : nat(nicCount / segmentSize), pool(pool) {
+    const size_t workerCount = min(pool.size(), nicCount);
+    const NicVM booted(nicProgram);
+    for(size_t w = 0; w < workerCount; w++) {
+      workers.push_back(make_unique<Worker>());
+      workers[w]->rings.resize(workerCount + 1);
+      for(auto &ring : workers[w]->rings) {
+        ring = make_unique<PacketRing>();
+      }
+    }
+    for(size_t address = 0; address < nicCount; address++) {
+      Worker &worker = *workers[address % workerCount];
+      worker.nics.push_back(booted.fork());
+      worker.nics.back().inputs.push(address % segmentSize);
+      worker.parked.push_back(false);
+      worker.ready.push_back(worker.nics.size() - 1);
+    }
+    for(size_t w = 0; w < workerCount; w++) {
+      for(size_t local = 0; local < workers[w]->nics.size(); local++) {
+        setPacketSink(workers[w]->nics[local], local * workerCount + w, [this, w](size_t from, IntCode to, const Packet &p) {
+          workers[w]->packetsSent++;
+          route(nat, from, to, p, [this, w](size_t address, const Packet &p) { send(w, address, p); });
+        });
+      }
+    }
+  }
+
+  IntCode run() {
+    for(size_t w = 0; w < workers.size(); w++) {
+      pool.submit([this, w]() { work(w); });
+    }
+    optional<IntCode> repeatedY;
+    while(!repeatedY.has_value()) {
+      waitForQuiescence();
+      repeatedY = nat.wakeUp([this](size_t address, const Packet &p) { send(workers.size(), address, p); });
+    }
+    stopping = true;
+    pool.wait();
+    return repeatedY.value();
+  }
+
+  size_t packetsSent() const {
+    size_t sent = 0;
+    for(const auto &worker : workers) sent += worker->packetsSent;
+    return sent;
+  }
+
+  size_t polls() const {
+    size_t polled = 0;
+    for(const auto &worker : workers) polled += worker->polls;
+    return polled;
+  }
+
+private:
+  struct Message
+  {
+    size_t address;
+    Packet packet;
+  };
+  using PacketRing = SpscRing<Message, 1024>;
+
+  struct Worker
+  {
+    vector<NicVM> nics {};
+    vector<bool> parked {};
+    deque<size_t> ready {};
+    // Incoming rings, indexed by sender, the last one is the coordinator's
+    vector<unique_ptr<PacketRing>> rings {};
+    size_t packetsSent = 0;
+    size_t polls = 0;
+    atomic<bool> idle {false};
+    atomic<size_t> epoch {0};
+  };
+
+  vector<unique_ptr<Worker>> workers {};
+  ThreadPool &pool;
+  atomic<size_t> crossSent {0};
+  atomic<size_t> crossReceived {0};
+  atomic<bool> stopping {false};
+
+  void deliverLocal(Worker &worker, size_t local, const Packet &p) {
+    NicVM &nic = worker.nics[local];
+    nic.inputs.push(p.x);
+    nic.inputs.push(p.y);
+    if(worker.parked[local]) {
+      worker.parked[local] = false;
+      worker.ready.push_back(local);
+    }
+  }
+
+  // From a worker, or from the coordinator when sender == workers.size()
+  void send(size_t sender, size_t address, const Packet &p) {
+    const size_t owner = address % workers.size();
+    if(owner == sender) {
+      deliverLocal(*workers[owner], address / workers.size(), p);
+      return;
+    }
+    crossSent++;
+    while(!workers[owner]->rings[sender]->push({address, p})) {
+      // The receiver may be blocked on a full ring to us, make room for it
+      if(sender < workers.size()) {
+        drain(sender);
+      }
+      this_thread::yield();
+    }
+  }
+
+  // Delivers the packets waiting in the incoming rings, false when there were none
+  bool drain(size_t w) {
+    Worker &worker = *workers[w];
+    bool received = false;
+    Message message;
+    for(auto &ring : worker.rings) {
+      while(ring->pop(message)) {
+        if(worker.idle) {
+          worker.idle = false;
+          worker.epoch++;
         }
-        packetSent++;
+        deliverLocal(worker, message.address / workers.size(), message.packet);
+        crossReceived++;
+        received = true;
       }
-      currentComputer.outputs.clear();
-    }
-    // Distribute packets and run
-    size_t packetReceived = 0;
-    for (size_t ip = 0; ip < 50; ip++){
-      auto &currentComputer = computers[ip];
-      auto &currentPacketQueue = packetQueues[ip];
-      if(currentPacketQueue.empty()) {
-        currentComputer.inputs.push(-1);
+    }
+    return received;
+  }
+
+  void work(size_t w) {
+    Worker &worker = *workers[w];
+    while(!stopping) {
+      drain(w);
+      if(worker.ready.empty()) {
+        worker.idle = true;
+        this_thread::yield();
+        continue;
       }
-      else {
-        allIdle = false;
-        while(!currentPacketQueue.empty()) {
-          currentComputer.inputs.push(currentPacketQueue.front().x);
-          currentComputer.inputs.push(currentPacketQueue.front().y);
-          currentPacketQueue.pop();
-          packetReceived++;
+      for(size_t batch = worker.ready.size(); batch > 0; batch--) {
+        const size_t local = worker.ready.front();
+        worker.ready.pop_front();
+        if(runNic(worker.nics[local], worker.packetsSent, worker.polls)) {
+          worker.parked[local] = true;
+        } else {
+          worker.ready.push_back(local);
         }
       }
+    }
+  }
 
-      computers[ip] = runProgram(currentComputer);
+  size_t epochs() const {
+    size_t sum = 0;
+    for(const auto &worker : workers) sum += worker->epoch;
+    return sum;
+  }
+
+  void waitForQuiescence() {
+    while(true) {
+      const size_t epochsBefore = epochs();
+      const bool allIdle = all_of(workers.cbegin(), workers.cend(), [](const auto &worker) { return worker->idle.load(); });
+      if(allIdle && crossSent == crossReceived && epochs() == epochsBefore) {
+        return;
+      }
+      this_thread::yield();
     }
+  }
+};
+
+int main(int argc, char const *argv[])
+{
+  const auto nicProgram = parseIntcode(getPuzzleInput("inputs/aoc_day23_1.txt").front());
 
-    if(allIdle && lastNATPacket.has_value()) {
-      packetQueues[0].push(lastNATPacket.value());
-      cout << "The network is idle, sending last NAT packet " << lastNATPacket.value() << " to 0\n";
+  // Optional arguments: number of NICs on the network, worker threads to also
+  // run it on and compare with the sequential scheduler
+  const size_t nicCount = argc > 1 ? stoul(argv[1]) : segmentSize;
+  const size_t threadCount = argc > 2 ? stoul(argv[2]) : 0;
+  if(nicCount == 0 || nicCount % segmentSize != 0) {
+    cerr << "The number of NICs must be a multiple of " << segmentSize << "\n";
+    return 1;
+  }
+
+  auto start = chrono::steady_clock::now();
+  Network network(nicProgram, nicCount);
+  const IntCode repeatedY = network.run();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  assert(network.nat.firstNatY.has_value());
+  cout << "Part1, first Y sent to the NAT: " << network.nat.firstNatY.value() << "\n";
+  cout << "Part2, first Y sent twice in a row by the NAT: " << repeatedY << "\n";
+  cerr << "Sequential: " << nicCount << " NICs, " << network.packetsSent << " packets, " << network.polls << " empty polls, "
+       << network.nat.wakeUps << " NAT wake ups in " << elapsed.count() << "s ("
+       << size_t(network.packetsSent / elapsed.count()) << " packets/s)\n";
+
+  if(threadCount > 0) {
+    ThreadPool pool(threadCount);
+    start = chrono::steady_clock::now();
+    ThreadedNetwork threaded(nicProgram, nicCount, pool);
+    const IntCode threadedRepeatedY = threaded.run();
+    elapsed = chrono::steady_clock::now() - start;
+    if(threadedRepeatedY != repeatedY || threaded.nat.firstNatY != network.nat.firstNatY) {
+      cerr << "The threaded network disagrees: " << threadedRepeatedY << " sent twice in a row\n";
+      return 1;
     }
-    cycleCount++;
-    cout << "Cycle " << cycleCount << ", sent " << packetSent << ", received " << packetReceived << "\n";
+    cerr << pool.size() << " threads: " << nicCount << " NICs, " << threaded.packetsSent() << " packets, " << threaded.polls() << " empty polls, "
+         << threaded.nat.wakeUps << " NAT wake ups in " << elapsed.count() << "s ("
+         << size_t(threaded.packetsSent() / elapsed.count()) << " packets/s)\n";
   }
-  
+
   return 0;
 }
-
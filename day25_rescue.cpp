@@ -1,8 +1,13 @@
 #include <iostream>
 #include <cassert>
+#include <chrono>
+#include <map>
+#include <sstream>
 #include "IntcodeComputer.cpp"
+#include "IntcodeCheckpoint.cpp"
+#include "threadpool.cpp"
 
-void pushInput(ProgramState &droid, const string instruction) {
+void pushInput(IntcodeVM &droid, const string instruction) {
   for(char c : instruction) {
     droid.inputs.push(c);
   }
@@ -25,54 +30,279 @@ Valid moves:
 - inv
 */
 
-const vector<string> replayInputs {
-  "west",
-  "take mug",
-  "north",
-  // "take easter egg",
-  "south",
-  "east", // back to start
-  "east",
-  "take coin",
-  "north",
-  "north",
-  "take hypercube",
-  "south",
-  "east",
-  // "take manifold",
-  "west",
-  "south",
-  "south",
-  "east",
-  // "take pointer",
-  "west",
-  "west",
-  "take astrolabe",
-  "north",
-  "east",
-  "north",
-  "east"
+const map<string, string> oppositeDoor {{"north", "south"}, {"south", "north"}, {"east", "west"}, {"west", "east"}};
+
+// Sends one command and returns what the droid printed back
+string command(IntcodeVM &droid, const string &instruction) {
+  droid.outputs.clear();
+  pushInput(droid, instruction);
+  return asciiToString(droid.resume().outputs);
+}
+
+// Room the droid stands in after a command, the last one described when the
+// pressure-sensitive floor pushed it back to the checkpoint
+struct RoomView
+{
+  string name;
+  vector<string> doors;
+  vector<string> items;
+  bool ejected = false;
 };
 
-int main(int argc, char const *argv[]) {
-  const auto droidProgram = parseIntcode(getPuzzleInput("inputs/aoc_day25_1.txt").front());
-  auto droid = runProgram(droidProgram);
+RoomView parseRoom(const string &text) {
+  RoomView view;
+  istringstream lines(text);
+  vector<string> *list = nullptr;
+  string line;
+  while(getline(lines, line)) {
+    if(line.rfind("== ", 0) == 0) {
+      view = {line.substr(3, line.size() - 6), {}, {}, view.ejected};
+    }
+    else if(line == "Doors here lead:") list = &view.doors;
+    else if(line == "Items here:") list = &view.items;
+    else if(line.rfind("- ", 0) == 0 && list) list->push_back(line.substr(2));
+    else if(line.rfind("A loud, robotic voice says \"Alert!", 0) == 0) view.ejected = true;
+    else list = nullptr;
+  }
+  return view;
+}
+
+// Takes the item on a fork of the droid standing next to it: the item is not
+// safe when the game ends, never asks for the next command or leaves the
+// droid unable to walk out
+bool safeItem(const IntcodeVM &droid, const string &item, const string &door) {
+  IntcodeVM probe = droid.fork();
+  pushInput(probe, "take " + item);
+  for(size_t budget = 1000000; probe.step(); budget--) {
+    if(budget == 0) {
+      return false;
+    }
+  }
+  return !probe.terminated && !parseRoom(command(probe, door)).name.empty();
+}
+
+struct Room
+{
+  RoomView view;
+  map<string, string> neighbours {}; // room behind each explored door
+  vector<string> safeItems {};
+};
 
-  for(string in : replayInputs) {
-    pushInput(droid, in);
+struct Ship
+{
+  map<string, Room> rooms;
+  string start;
+  string checkpoint;
+  string floorDoor;
+};
+
+// Breadth first search of the rooms, a level at a time on the pool: every
+// droid of the frontier is a fork of the one that reached its room, it tests
+// the items there and tries the doors not explored yet on forks of its own
+Ship exploreShip(const vector<IntCode> &program, ThreadPool &pool) {
+  IntcodeVM droid(program);
+  Ship ship;
+  const RoomView start = parseRoom(asciiToString(droid.resume().outputs));
+  ship.start = start.name;
+  ship.rooms[start.name] = {start};
+  vector<pair<string, IntcodeVM>> frontier {{start.name, droid}};
+  while(!frontier.empty()) {
+    struct Expansion
+    {
+      vector<string> safeItems;
+      vector<tuple<string, RoomView, IntcodeVM>> moves;
+    };
+    vector<Expansion> expansions(frontier.size());
+    parallelChunks(pool, frontier.size(), [&](size_t begin, size_t end) {
+      for(size_t i = begin; i < end; i++) {
+        const auto &[name, here] = frontier[i];
+        const Room &room = ship.rooms.at(name);
+        for(const string &item : room.view.items) {
+          if(safeItem(here, item, room.view.doors.front())) {
+            expansions[i].safeItems.push_back(item);
+          }
+        }
+        for(const string &door : room.view.doors) {
+          if(!room.neighbours.count(door)) {
+            IntcodeVM moved = here.fork();
+            const RoomView view = parseRoom(command(moved, door));
+            expansions[i].moves.emplace_back(door, view, move(moved));
+          }
+        }
+      }
+    });
+
+    vector<pair<string, IntcodeVM>> next;
+    for(size_t i = 0; i < frontier.size(); i++) {
+      const string &name = frontier[i].first;
+      ship.rooms[name].safeItems = expansions[i].safeItems;
+      for(auto &[door, view, moved] : expansions[i].moves) {
+        if(view.ejected) {
+          ship.checkpoint = name;
+          ship.floorDoor = door;
+          continue;
+        }
+        ship.rooms[name].neighbours[door] = view.name;
+        const bool discovered = !ship.rooms.count(view.name);
+        ship.rooms[view.name].neighbours[oppositeDoor.at(door)] = name;
+        if(discovered) {
+          ship.rooms[view.name].view = view;
+          next.push_back({view.name, move(moved)});
+        }
+      }
+    }
+    frontier = move(next);
   }
-  droid = runProgram(droid);
+  if(ship.checkpoint.empty()) {
+    cerr << "No pressure-sensitive floor found\n";
+    throw;
+  }
+  return ship;
+}
 
+// Doors to walk through from one room to another
+vector<string> route(const Ship &ship, const string &from, const string &to) {
+  map<string, pair<string, string>> reachedFrom {{from, {"", ""}}};
+  vector<string> front {from};
+  while(!reachedFrom.count(to) && !front.empty()) {
+    vector<string> next;
+    for(const string &name : front) {
+      for(const auto &[door, neighbour] : ship.rooms.at(name).neighbours) {
+        if(reachedFrom.emplace(neighbour, make_pair(name, door)).second) {
+          next.push_back(neighbour);
+        }
+      }
+    }
+    front = move(next);
+  }
+  vector<string> doors;
+  for(string name = to; name != from; name = reachedFrom.at(name).first) {
+    doors.push_back(reachedFrom.at(name).second);
+  }
+  return {doors.rbegin(), doors.rend()};
+}
+
+// Walks a single droid to every safe item, nearest first, then to the
+// checkpoint. Returns the items in the order they were taken.
+vector<string> collectItems(IntcodeVM &droid, const Ship &ship) {
+  vector<string> itemRooms;
+  for(const auto &[name, room] : ship.rooms) {
+    if(!room.safeItems.empty()) {
+      itemRooms.push_back(name);
+    }
+  }
+  vector<string> items;
+  string here = ship.start;
+  const auto walkTo = [&](const string &to) {
+    for(const string &door : route(ship, here, to)) {
+      command(droid, door);
+    }
+    here = to;
+  };
+  while(!itemRooms.empty()) {
+    const auto nearest = min_element(itemRooms.begin(), itemRooms.end(), [&](const string &a, const string &b) {
+      return route(ship, here, a).size() < route(ship, here, b).size();
+    });
+    walkTo(*nearest);
+    for(const string &item : ship.rooms.at(here).safeItems) {
+      command(droid, "take " + item);
+      items.push_back(item);
+    }
+    itemRooms.erase(nearest);
+  }
+  walkTo(ship.checkpoint);
+  return items;
+}
+
+// Tries the inventory subsets on the pressure-sensitive floor in Gray code
+// order, bit i set when items[i] is held: a single take or drop between two
+// attempts. Chunks of the sequence run on the pool, each from a snapshot of
+// the droid holding every item. Returns the game's last words once through.
+optional<string> passCheckpoint(const IntcodeVM &droid, const vector<string> &items, const string &floorDoor,
+  ThreadPool &pool, atomic<size_t> &attempts) {
+  const auto holdingAll = droid.snapshot();
+  const size_t subsets = size_t(1) << items.size();
+  mutex passedLock;
+  optional<string> passed;
+  atomic<bool> done {false};
+  parallelChunks(pool, subsets, [&](size_t begin, size_t end) {
+    IntcodeVM probe = holdingAll.fork();
+    const size_t held = begin ^ (begin >> 1);
+    for(size_t i = 0; i < items.size(); i++) {
+      if(!(held >> i & 1)) {
+        command(probe, "drop " + items[i]);
+      }
+    }
+    for(size_t subset = begin; subset < end && !done; subset++) {
+      if(subset > begin) {
+        const size_t item = __builtin_ctzll(subset);
+        command(probe, ((subset ^ (subset >> 1)) >> item & 1 ? "take " : "drop ") + items[item]);
+      }
+      attempts++;
+      const string reply = command(probe, floorDoor);
+      if(probe.terminated) {
+        lock_guard<mutex> lock(passedLock);
+        passed = reply;
+        done = true;
+      }
+    }
+  });
+  return passed;
+}
+
+// Moves are read from stdin, type save to checkpoint the droid
+void driveManually(const string &checkpointPath) {
+  IntcodeVM droid = ifstream(checkpointPath).good()
+    ? loadIntcodeCheckpoint(checkpointPath)
+    : IntcodeVM(parseIntcode(getPuzzleInput("inputs/aoc_day25_1.txt").front())).resume();
   string instruction;
-  while(!droid.terminated) {
-    cout << asciiToString(droid.outputs) << "\n";
-    getline(cin, instruction);
-    pushInput(droid, instruction);
+  cout << asciiToString(droid.outputs) << "\n";
+  while(!droid.terminated && getline(cin, instruction)) {
+    if(instruction == "save") {
+      saveIntcodeCheckpoint(droid, checkpointPath);
+      cout << "Checkpoint saved to " << checkpointPath << "\n";
+      continue;
+    }
     droid.outputs.clear();
-    droid = runProgram(droid);
+    pushInput(droid, instruction);
+    droid.resume();
+    cout << asciiToString(droid.outputs) << "\n";
   }
-  cout << asciiToString(droid.outputs) << "\n";
-  
-  return 0;
 }
 
+int main(int argc, char const *argv[]) {
+  testIntcodeCheckpoint();
+
+  // Optional argument: checkpoint file, the droid is then driven from stdin
+  // and restored from that file when it exists
+  if(argc > 1) {
+    driveManually(argv[1]);
+    return 0;
+  }
+
+  const auto program = parseIntcode(getPuzzleInput("inputs/aoc_day25_1.txt").front());
+  const auto start = chrono::steady_clock::now();
+  ThreadPool pool;
+  const Ship ship = exploreShip(program, pool);
+  IntcodeVM droid(program);
+  droid.resume();
+  const vector<string> items = collectItems(droid, ship);
+  atomic<size_t> attempts {0};
+  const auto passed = passCheckpoint(droid, items, ship.floorDoor, pool, attempts);
+  const auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+  if(!passed) {
+    cerr << "No combination of the " << items.size() << " items is let through\n";
+    return 1;
+  }
+
+  const size_t typing = passed->find("typing ");
+  if(typing == string::npos) {
+    cerr << "No password in the game's last words:\n" << *passed << "\n";
+    throw;
+  }
+  cout << "Part1, airlock password: " << stol(passed->substr(typing + 7)) << "\n";
+  cerr << "Solved in " << micros << "us: " << ship.rooms.size() << " rooms, " << items.size() << " safe items, "
+       << attempts << " weighings\n";
+
+  return 0;
+}
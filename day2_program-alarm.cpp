@@ -3,31 +3,72 @@
 #include <tuple>
 #include <cassert>
 #include "IntcodeComputer.cpp"
+#include "IntcodeSymbolic.cpp"
+#include "threadpool.cpp"
+
+const IntCode expectedOutput = 19690720;
+const size_t nounVerbRange = 99;
+
+IntCode runWithNounVerb(const IntcodeSnapshot &gravityAssist, size_t noun, size_t verb) {
+  auto vm = gravityAssist.fork();
+  vm.write(1, noun);
+  vm.write(2, verb);
+  return vm.resume().read(0);
+}
+
+// Candidates are indexed noun * nounVerbRange + verb, the serial scan order
+optional<size_t> findNounVerb(const IntcodeSnapshot &gravityAssist) {
+  for (size_t noun = 0; noun < nounVerbRange; noun++)
+  {
+    for (size_t verb = 0; verb < nounVerbRange; verb++)
+    {
+      if(runWithNounVerb(gravityAssist, noun, verb) == expectedOutput) {
+        return noun * nounVerbRange + verb;
+      }
+    }
+  }
+  return nullopt;
+}
+
+optional<size_t> findNounVerbParallel(const IntcodeSnapshot &gravityAssist, ThreadPool &pool) {
+  return parallelFindFirst(pool, nounVerbRange * nounVerbRange, [&](size_t candidate) {
+    return runWithNounVerb(gravityAssist, candidate / nounVerbRange, candidate % nounVerbRange) == expectedOutput;
+  });
+}
+
+// The program is run once with noun and verb as variables, and the polynomial
+// it leaves in cell 0 solved. Searched when a branch or an address depends on them.
+optional<size_t> findNounVerbSymbolic(const vector<IntCode> &program, const IntcodeSnapshot &gravityAssist, ThreadPool &pool) {
+  SymbolicIntcodeRun symbolic(program, {1, 2});
+  const auto output = symbolic.run() ? symbolic.cell(0) : nullopt;
+  if(!output) {
+    return findNounVerbParallel(gravityAssist, pool);
+  }
+  const auto solution = solveIntcodePolynomial(*output, expectedOutput, {{0, nounVerbRange}, {0, nounVerbRange}});
+  return solution ? optional<size_t>((*solution)[0] * nounVerbRange + (*solution)[1]) : nullopt;
+}
 
 int main(int argc, char const *argv[])
 {
   testComputer();
+  testIntcodeSymbolic();
   
   // Part 1
   vector<string> input = getPuzzleInput("./inputs/aoc_day2_1.txt");
   const auto part1 = runProgram(input.front()).memory;
   cout << "part1, pos0: " << part1[0] << "\n";
   
-  // Part 2
-  auto tweakableInput = parseIntcode(input.front());
-  for (size_t noun = 0; noun < 99; noun++)
-  {
-    for (size_t verb = 0; verb < 99; verb++)
-    {
-      tweakableInput[1] = noun;
-      tweakableInput[2] = verb;
-      const auto part2 = runProgram(tweakableInput).memory;
-      if(part2[0] == 19690720) {
-        cout << "part2, answer for output 19690720: noun = " << noun << " & verb = " << verb << "\n";
-        cout << "100 * noun + verb = " << 100 * noun + verb << "\n";
-        return 0;
-      }
-    }
+  // Part 2, optional argument: worker thread count
+  const auto program = parseIntcode(input.front());
+  const auto gravityAssist = IntcodeVM(program).snapshot();
+  ThreadPool pool(argc > 1 ? stoul(argv[1]) : thread::hardware_concurrency());
+  const auto candidate = findNounVerbSymbolic(program, gravityAssist, pool);
+  assert(candidate == findNounVerb(gravityAssist) && candidate == findNounVerbParallel(gravityAssist, pool));
+  if(candidate.has_value()) {
+    const size_t noun = candidate.value() / nounVerbRange;
+    const size_t verb = candidate.value() % nounVerbRange;
+    cout << "part2, answer for output 19690720: noun = " << noun << " & verb = " << verb << "\n";
+    cout << "100 * noun + verb = " << 100 * noun + verb << "\n";
   }
 
   return 0;
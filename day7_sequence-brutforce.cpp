@@ -1,69 +1,137 @@
 #include <iostream>
 #include <queue>
 #include <algorithm>
+#include <numeric>
+#include <limits>
 #include "IntcodeComputer.cpp"
+#include "threadpool.cpp"
+#ifdef __cpp_impl_coroutine
+#include "IntcodePipeline.cpp"
+#endif
 
-int maxThrusterSignal(const string program) {
-  int biggestSignal = 0;
-  vector<int> phaseSettingSequence {0, 1, 2, 3, 4};
+vector<vector<int>> phasePermutations(vector<int> phaseSettingSequence) {
+  vector<vector<int>> permutations;
   do {
-    queue<int> programInput;
-    int signal = 0;
-    for (int phaseSetting : phaseSettingSequence)
+    permutations.push_back(phaseSettingSequence);
+  } while (next_permutation(phaseSettingSequence.begin(), phaseSettingSequence.end()));
+  return permutations;
+}
+
+int thrusterSignal(const vector<IntCode> &program, const vector<int> &phaseSettingSequence) {
+  int signal = 0;
+  for (int phaseSetting : phaseSettingSequence)
+  {
+    IntcodeVM amplifier(program, queue<IntCode>({phaseSetting, signal}));
+    signal = amplifier.resume().outputs.back();
+  }
+  return signal;
+}
+
+int loopedThrusterSignal(const vector<IntCode> &program, const vector<int> &phaseSettingSequence) {
+  vector<IntcodeVM> amplifiers;
+  for (int phaseSetting : phaseSettingSequence) {
+    amplifiers.emplace_back(program, queue<IntCode>({phaseSetting}));
+  }
+  IntCode inputSignal = 0;
+  while(!amplifiers.back().terminated) {
+    for (auto &amplifier : amplifiers)
     {
-      programInput = {};
-      programInput.push(phaseSetting);
-      programInput.push(signal);
-      const auto amplifierOutput = runProgram(program, programInput);
-      signal = amplifierOutput.outputs.back();
-    }
-    if (signal > biggestSignal) {
-      biggestSignal = signal;
+      amplifier.inputs.push(inputSignal);
+      amplifier.resume();
+      inputSignal = amplifier.outputs.back();
     }
-  } while (next_permutation(phaseSettingSequence.begin(), phaseSettingSequence.end()));
+  }
+  return inputSignal;
+}
+
+// Depth first walk of the phase permutations as a trie: the signal out of a
+// prefix is computed once and shared by every permutation starting with it,
+// so only the amplifiers after the prefix run. Each run forks the booted
+// amplifier. Counts the amplifier runs in vmRuns.
+IntCode prefixTrieMaxSignal(const IntcodeSnapshot &amplifier, const vector<int> &phases, vector<bool> &used, IntCode signal, size_t &vmRuns) {
+  if (find(used.cbegin(), used.cend(), false) == used.cend()) {
+    return signal;
+  }
+  IntCode biggestSignal = numeric_limits<IntCode>::min();
+  for (size_t i = 0; i < phases.size(); i++) {
+    if (used[i]) continue;
+    auto vm = amplifier.fork();
+    vm.inputs.push(phases[i]);
+    vm.inputs.push(signal);
+    vmRuns++;
+    const IntCode nextSignal = vm.resume().outputs.back();
+    used[i] = true;
+    biggestSignal = max(biggestSignal, prefixTrieMaxSignal(amplifier, phases, used, nextSignal, vmRuns));
+    used[i] = false;
+  }
   return biggestSignal;
 }
 
-int maxLoopedThrusterSignal(const string programStr) {
+IntCode prefixTrieMaxSignal(const vector<IntCode> &program, const vector<int> &phases, size_t &vmRuns) {
+  vector<bool> used(phases.size(), false);
+  return prefixTrieMaxSignal(IntcodeVM(program).snapshot(), phases, used, 0, vmRuns);
+}
+
+#ifdef __cpp_impl_coroutine
+// Amplifiers run as coroutines wired through channels, in a chain or, with
+// feedback, in a loop. The signal is the last output of the last amplifier.
+int pipelinedThrusterSignal(const vector<IntCode> &program, const vector<int> &phaseSettingSequence, bool feedback) {
+  IntcodePipeline amplifiers;
+  for (int phaseSetting : phaseSettingSequence) {
+    amplifiers.feed(amplifiers.addStage(IntcodeVM(program)), phaseSetting);
+  }
+  const size_t last = phaseSettingSequence.size() - 1;
+  for (size_t i = 0; i < last; i++) {
+    amplifiers.connect(i, i + 1);
+  }
+  if(feedback) {
+    amplifiers.connect(last, 0);
+  }
+  amplifiers.feed(0, 0);
+  const bool terminated = amplifiers.run();
+  assert(terminated);
+  return amplifiers.lastOutput(last).value();
+}
+#endif
+
+// Without a pool the permutations are walked serially
+template<typename AmplifierChain>
+int maxSignal(const string programStr, const vector<int> &phases, AmplifierChain chain, ThreadPool *pool) {
   const auto program = parseIntcode(programStr);
-  vector<int> phaseSettingSequence = {5, 6, 7, 8, 9};
+  const auto permutations = phasePermutations(phases);
+  const auto signalOf = [&](size_t i) { return chain(program, permutations[i]); };
+  const auto maximum = [](int a, int b) { return max(a, b); };
+  if(pool) {
+    return parallelReduce(*pool, permutations.size(), 0, signalOf, maximum);
+  }
   int biggestSignal = 0;
-  do {
-    ProgramState programStates[5];
-    int terminatedCount = 0;
-    bool phaseInitDone = false;
-    while(terminatedCount < 5) {
-      for (int i = 0; i < 5; i++)
-      {
-        if(!phaseInitDone) {
-          programStates[i].memory = program;
-          programStates[i].inputs.push(phaseSettingSequence[i]);
-        }
+  for (size_t i = 0; i < permutations.size(); i++) {
+    biggestSignal = maximum(biggestSignal, signalOf(i));
+  }
+  return biggestSignal;
+}
 
-        const int inputSignal = (i == 0) 
-          ? (!phaseInitDone ? 0 : programStates[4].outputs.back()) 
-          : programStates[i-1].outputs.back();
-        programStates[i].inputs.push(inputSignal);
+int maxThrusterSignal(const string program, ThreadPool *pool = nullptr) {
+  return maxSignal(program, {0, 1, 2, 3, 4}, thrusterSignal, pool);
+}
 
-        const auto amplifierOutput = runProgram(programStates[i]);
-        if(amplifierOutput.terminated) {
-          terminatedCount++;
-        }
-        programStates[i] = amplifierOutput;
-      }
-      phaseInitDone = true;
-    }
-    const auto signal = programStates[4].outputs.back();
-    if (signal > biggestSignal) {
-      biggestSignal = signal;
-    }
-  } while (next_permutation(phaseSettingSequence.begin(), phaseSettingSequence.end()));
-  return biggestSignal;
+int maxLoopedThrusterSignal(const string program, ThreadPool *pool = nullptr) {
+  return maxSignal(program, {5, 6, 7, 8, 9}, loopedThrusterSignal, pool);
 }
 
+#ifdef __cpp_impl_coroutine
+int maxPipelinedThrusterSignal(const string program, bool feedback, ThreadPool *pool = nullptr) {
+  const auto chain = [feedback](const vector<IntCode> &p, const vector<int> &phases) { return pipelinedThrusterSignal(p, phases, feedback); };
+  return maxSignal(program, feedback ? vector<int>({5, 6, 7, 8, 9}) : vector<int>({0, 1, 2, 3, 4}), chain, pool);
+}
+#endif
+
 int main(int argc, char const *argv[])
 {
   testComputer();
+#ifdef __cpp_impl_coroutine
+  testIntcodePipeline();
+#endif
 
   // Part 1
   const auto ampControl1 = "3,15,3,16,1002,16,10,16,1,16,15,15,4,15,99,0,0";
@@ -72,17 +140,74 @@ int main(int argc, char const *argv[])
   assert(maxThrusterSignal(ampControl2) == 54321);
   const auto ampControl3 = "3,31,3,32,1002,32,10,32,1001,31,-2,31,1007,31,0,33,1002,33,7,33,1,33,31,31,1,32,31,31,4,31,99,0,0,0";
   assert(maxThrusterSignal(ampControl3) == 65210);
+#ifdef __cpp_impl_coroutine
+  assert(maxPipelinedThrusterSignal(ampControl1, false) == 43210);
+#endif
+
+  // Optional argument: worker thread count for the parallel search
+  ThreadPool pool(argc > 1 ? stoul(argv[1]) : thread::hardware_concurrency());
+  const auto amplifierProgram = getPuzzleInput("./inputs/aoc_day7_1.txt").front();
 
-  const auto p1 = maxThrusterSignal(getPuzzleInput("./inputs/aoc_day7_1.txt").front());
+  // Amplifiers run as a pipeline when coroutines are available, the serial
+  // search checks it
+#ifdef __cpp_impl_coroutine
+  const auto p1 = maxPipelinedThrusterSignal(amplifierProgram, false, &pool);
+#else
+  const auto p1 = maxThrusterSignal(amplifierProgram, &pool);
+#endif
+  assert(p1 == maxThrusterSignal(amplifierProgram));
   cout << "Part1, max thruster output: " << p1 << "\n";
 
+  // Prefix trie search, against the 5 runs of each of the 5! permutations
+  size_t trieRuns = 0;
+  assert(prefixTrieMaxSignal(parseIntcode(ampControl1), {0, 1, 2, 3, 4}, trieRuns) == 43210);
+  assert(prefixTrieMaxSignal(parseIntcode(ampControl3), {0, 1, 2, 3, 4}, trieRuns) == 65210);
+  trieRuns = 0;
+  const IntCode trieMax = prefixTrieMaxSignal(parseIntcode(amplifierProgram), {0, 1, 2, 3, 4}, trieRuns);
+  assert(trieMax == p1);
+  cout << "Part1 prefix trie: " << trieRuns << " amplifier runs instead of " << 5 * 120 << "\n";
+
+  // Scaling with more phases, on a synthetic amplifier: output = 3 * signal + phase + 1
+  // Optional second argument: largest phase count, 8 by default
+  const int maxPhaseCount = argc > 2 ? stoi(argv[2]) : 8;
+  const auto syntheticAmplifier = parseIntcode("3,100,3,101,1002,101,3,101,1,101,100,101,1001,101,1,101,4,101,99");
+  for (int phaseCount = 5; phaseCount <= maxPhaseCount; phaseCount++) {
+    vector<int> phases(phaseCount);
+    iota(phases.begin(), phases.end(), 0);
+    size_t runs = 0;
+    [[maybe_unused]] const IntCode trieSignal = prefixTrieMaxSignal(syntheticAmplifier, phases, runs);
+    size_t naiveRuns = phaseCount;
+    for (int n = 2; n <= phaseCount; n++) naiveRuns *= n;
+#ifndef NDEBUG
+    // Every permutation run in full, only to check the trie
+    if (phaseCount <= 8) {
+      IntCode naiveSignal = 0;
+      for (const auto &permutation : phasePermutations(phases)) {
+        IntCode signal = 0;
+        for (int phase : permutation) {
+          signal = IntcodeVM(syntheticAmplifier, queue<IntCode>({phase, signal})).resume().outputs.back();
+        }
+        naiveSignal = max(naiveSignal, signal);
+      }
+      assert(trieSignal == naiveSignal);
+    }
+#endif
+    cout << phaseCount << " phases prefix trie: " << runs << " amplifier runs instead of " << naiveRuns << "\n";
+  }
+
   // Part 2
   const auto ampLoopedControl1 = "3,26,1001,26,-4,26,3,27,1002,27,2,27,1,27,26,27,4,27,1001,28,-1,28,1005,28,6,99,0,0,5";
   assert(maxLoopedThrusterSignal(ampLoopedControl1) == 139629729);
   const auto ampLoopedControl2 = "3,52,1001,52,-5,52,3,53,1,52,56,54,1007,54,5,55,1005,55,26,1001,54,-5,54,1105,1,12,1,53,54,53,1008,54,0,55,1001,55,1,55,2,53,55,53,4,53,1001,56,-1,56,1005,56,6,99,0,0,0,0,10";
   assert(maxLoopedThrusterSignal(ampLoopedControl2) == 18216);
-
-  const auto p2 = maxLoopedThrusterSignal(getPuzzleInput("./inputs/aoc_day7_1.txt").front());
+#ifdef __cpp_impl_coroutine
+  assert(maxPipelinedThrusterSignal(ampLoopedControl1, true) == 139629729);
+  assert(maxPipelinedThrusterSignal(ampLoopedControl2, true) == 18216);
+  const auto p2 = maxPipelinedThrusterSignal(amplifierProgram, true, &pool);
+#else
+  const auto p2 = maxLoopedThrusterSignal(amplifierProgram, &pool);
+#endif
+  assert(p2 == maxLoopedThrusterSignal(amplifierProgram));
   cout << "Part1, max thruster output: " << p2 << "\n";
 
   return 0;
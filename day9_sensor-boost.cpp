@@ -1,9 +1,16 @@
 #include <iostream>
 #include "IntcodeComputer.cpp"
+#include "IntcodeProfiler.cpp"
+#include "IntcodeTrace.cpp"
+// Native code from intcode-aot, when it has been generated
+#if __has_include("aot/aoc_day9_1.cpp")
+#include "aot/aoc_day9_1.cpp"
+#endif
 
 int main(int argc, char const *argv[])
 {
   testComputer();
+  testIntcodeTrace();
 
   const queue<IntCode> p1Input({1});
   const auto p1Program = getPuzzleInput("./inputs/aoc_day9_1.txt").front();
@@ -16,5 +23,14 @@ int main(int argc, char const *argv[])
   assert(p2.terminated);
   cout << "Part2, distress signal coordinates: " << p2.outputs << "\n";
 
+  // Optional argument: path of a JSON profile of part 2
+  if(argc > 1) {
+    ProfiledIntcodeVM profiled(parseIntcode(p1Program), p2Input);
+    profiled.resume();
+    assert(profiled.outputs == p2.outputs);
+    profiled.instrumentation.report(cout);
+    profiled.instrumentation.writeJson(argv[1]);
+  }
+
   return 0;
 }
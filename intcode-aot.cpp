@@ -0,0 +1,240 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include "IntcodeImage.cpp"
+
+// Ahead of time compiler from an Intcode program to a C++ function:
+//   intcode-aot inputs/aoc_day9_1.txt aot/aoc_day9_1.cpp
+// Drivers include aot/<input name>.cpp when it exists (__has_include), so
+// generating it and rebuilding the driver is all it takes:
+//   mkdir -p aot && g++ -std=c++17 -O2 -o intcode-aot intcode-aot.cpp
+//   ./intcode-aot inputs/aoc_day9_1.txt aot/aoc_day9_1.cpp
+//   ./intcode-aot inputs/aoc_day19_1.txt aot/aoc_day19_1.cpp
+//   g++ -std=c++17 -O2 -o day9 day9_sensor-boost.cpp
+//
+// Code is found by following the control flow from address 0: direct jumps
+// are followed, the instruction after a jump is always assumed reachable (it
+// is where calls return to). Computed jumps go through a switch over every
+// compiled address, any other target falls back to the interpreter, as do
+// writes changing a compiled instruction. Operands the program patches through
+// a constant address are read from memory instead.
+
+size_t instructionLength(DecodedInstruction decoded) {
+  const int code = decoded / 27;
+  return decoded == haltInstruction ? 1 : code == 1 || code == 2 || code == 7 || code == 8 ? 4 : code == 5 || code == 6 ? 3 : 2;
+}
+
+string literal(IntCode value) {
+  return "IntCode(" + to_string(value) + "LL)";
+}
+
+class IntcodeAotCompiler
+{
+public:
+  IntcodeAotCompiler(const vector<IntCode> &image) : image(image) {
+    // Operands written by the program are read from memory, jumps through
+    // them become computed jumps: explore again until no new one shows up
+    size_t patchedCount;
+    do {
+      patchedCount = patched.size();
+      explore();
+      for(const auto &[pc, decoded] : instructions) {
+        const int code = decoded / 27;
+        const size_t param = code == 3 ? 1 : 3;
+        const int mode = (code == 3 ? decoded : decoded / 9) % 3;
+        if((code == 1 || code == 2 || code == 3 || code == 7 || code == 8) && mode == PositionMode
+          && !patched.count(pc + param) && isOperandCell(image[pc + param])) {
+          patched.insert(image[pc + param]);
+        }
+      }
+    } while(patched.size() != patchedCount);
+  }
+
+  string generate(const string &name, const string &source) const {
+    ostringstream out;
+    out << "// Generated by intcode-aot from " << source << ", do not edit: generate it again instead.\n"
+        << "// Include it after IntcodeComputer.cpp.\n"
+        << "#pragma once\n\n"
+        << "IntcodeNativeExit intcodeNative_" << name << "(IntcodeNativeFrame &f) {\n"
+        << "  IntCode rb = f.relativeBase;\n"
+        << "  size_t target = f.instructionPointer;\n"
+        << "dispatch:\n"
+        << "  switch(target) {\n";
+    for(const auto &[pc, decoded] : instructions) {
+      out << "    case " << pc << ": goto pc" << pc << ";\n";
+    }
+    out << "    default: return f.exit(IntcodeNativeExit::Interpret, target, rb);\n"
+        << "  }\n";
+    for(const auto &[pc, decoded] : instructions) {
+      out << "pc" << pc << ":\n";
+      emitInstruction(out, pc, decoded);
+    }
+    for(const size_t pc : stops) {
+      out << "pc" << pc << ":\n"
+          << "  return f.exit(IntcodeNativeExit::Interpret, " << pc << ", rb);\n";
+    }
+    out << "}\n\n";
+
+    out << "IntcodeNativeProgram intcodeNativeProgram_" << name << " {" << hashIntcode(image) << "ull, " << image.size()
+        << ", &intcodeNative_" << name << ", {";
+    for(const size_t cell : codeCells()) {
+      out << "{" << cell << ", " << literal(image[cell]) << "}, ";
+    }
+    out << "}};\n"
+        << "const bool intcodeNativeRegistered_" << name << " = registerNativeIntcode(intcodeNativeProgram_" << name << ");\n";
+    return out.str();
+  }
+
+  size_t instructionCount() const { return instructions.size(); }
+  size_t stopCount() const { return stops.size(); }
+  size_t patchedCount() const { return patched.size(); }
+
+  set<size_t> codeCells() const {
+    set<size_t> cells;
+    for(const auto &[pc, decoded] : instructions) {
+      for(size_t i = 0; i < instructionLength(decoded); i++) {
+        if(!patched.count(pc + i)) {
+          cells.insert(pc + i);
+        }
+      }
+    }
+    return cells;
+  }
+
+private:
+  const vector<IntCode> &image;
+  map<size_t, DecodedInstruction> instructions {};
+  set<size_t> stops {};
+  set<size_t> patched {};
+
+  void explore() {
+    instructions.clear();
+    stops.clear();
+    vector<size_t> pending {0};
+    while(!pending.empty()) {
+      const size_t pc = pending.back();
+      pending.pop_back();
+      if(instructions.count(pc) || stops.count(pc)) {
+        continue;
+      }
+      const DecodedInstruction decoded = pc < image.size() && !patched.count(pc) ? decodeInstruction(image[pc]) : invalidInstruction;
+      if(decoded == invalidInstruction || pc + instructionLength(decoded) > image.size()) {
+        stops.insert(pc);
+        continue;
+      }
+      instructions[pc] = decoded;
+      if(decoded == haltInstruction) {
+        continue;
+      }
+      pending.push_back(pc + instructionLength(decoded));
+      if(const auto target = directJumpTarget(pc, decoded)) {
+        pending.push_back(*target);
+      }
+    }
+  }
+
+  bool isOperandCell(IntCode address) const {
+    for(const auto &[pc, decoded] : instructions) {
+      if(address > IntCode(pc) && address < IntCode(pc + instructionLength(decoded))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  optional<size_t> directJumpTarget(size_t pc, DecodedInstruction decoded) const {
+    const int code = decoded / 27;
+    if((code == 5 || code == 6) && decoded / 3 % 3 == ImmediateMode && !patched.count(pc + 2) && image[pc + 2] >= 0) {
+      return image[pc + 2];
+    }
+    return nullopt;
+  }
+
+  string operand(size_t pc, size_t param) const {
+    return patched.count(pc + param) ? "f.read(" + literal(pc + param) + ")" : literal(image[pc + param]);
+  }
+
+  string value(size_t pc, size_t param, int mode) const {
+    if(mode == ImmediateMode) return operand(pc, param);
+    if(mode == RelativeMode) return "f.read(rb + " + operand(pc, param) + ")";
+    return "f.read(" + operand(pc, param) + ")";
+  }
+
+  string address(size_t pc, size_t param, int mode) const {
+    if(mode == ImmediateMode) return literal(pc + param);
+    if(mode == RelativeMode) return "rb + " + operand(pc, param);
+    return operand(pc, param);
+  }
+
+  string jumpTo(size_t next) const {
+    return instructions.count(next) || stops.count(next)
+      ? "goto pc" + to_string(next) + ";"
+      : "return f.exit(IntcodeNativeExit::Interpret, " + to_string(next) + ", rb);";
+  }
+
+  void emitInstruction(ostream &out, size_t pc, DecodedInstruction decoded) const {
+    const int code = decoded / 27;
+    const int mode1 = decoded % 3;
+    const int mode2 = decoded / 3 % 3;
+    const int mode3 = decoded / 9 % 3;
+    const size_t next = pc + instructionLength(decoded);
+    const string interpretNext = "return f.exit(IntcodeNativeExit::Interpret, " + to_string(next) + ", rb);";
+
+    if(decoded == haltInstruction) {
+      out << "  return f.exit(IntcodeNativeExit::Halted, " << pc << ", rb);\n";
+      return;
+    }
+    if(code == 1 || code == 2 || code == 7 || code == 8) {
+      const string a = value(pc, 1, mode1);
+      const string b = value(pc, 2, mode2);
+      const string result = code == 1 ? a + " + " + b : code == 2 ? a + " * " + b
+        : "(" + a + (code == 7 ? " < " : " == ") + b + " ? 1 : 0)";
+      out << "  if(!f.write(" << address(pc, 3, mode3) << ", " << result << ")) " << interpretNext << "\n";
+    }
+    else if(code == 3) {
+      out << "  {\n"
+          << "    const optional<IntCode> in = f.input(f.vm);\n"
+          << "    if(!in) return f.exit(IntcodeNativeExit::Paused, " << pc << ", rb);\n"
+          << "    if(!f.write(" << address(pc, 1, mode1) << ", *in)) " << interpretNext << "\n"
+          << "  }\n";
+    }
+    else if(code == 4) {
+      out << "  if(!f.output(f.vm, " << value(pc, 1, mode1) << ")) return f.exit(IntcodeNativeExit::Paused, " << next << ", rb);\n";
+    }
+    else if(code == 5 || code == 6) {
+      const string condition = value(pc, 1, mode1) + (code == 5 ? " != 0" : " == 0");
+      if(const auto target = directJumpTarget(pc, decoded)) {
+        out << "  if(" << condition << ") " << jumpTo(*target) << "\n";
+      } else {
+        out << "  if(" << condition << ") { target = size_t(" << value(pc, 2, mode2) << "); goto dispatch; }\n";
+      }
+    }
+    else if(code == 9) {
+      out << "  rb += " << value(pc, 1, mode1) << ";\n";
+    }
+    out << "  " << jumpTo(next) << "\n";
+  }
+};
+
+int main(int argc, char const *argv[])
+{
+  if(argc < 3) {
+    cerr << "Usage: " << argv[0] << " <program.txt|program.intcode> <output.cpp> [name]\n";
+    return 1;
+  }
+  const string source = argv[1];
+  string name = argc > 3 ? argv[3] : source.substr(source.find_last_of('/') + 1);
+  name = name.substr(0, name.find('.'));
+  replace_if(name.begin(), name.end(), [](char c) { return !isalnum(static_cast<unsigned char>(c)); }, '_');
+
+  const vector<IntCode> image = loadIntcodeMemory(source).toVector();
+  const IntcodeAotCompiler compiler(image);
+  ofstream(argv[2]) << compiler.generate(name, source);
+
+  cout << argv[2] << ": " << compiler.instructionCount() << " instructions compiled covering "
+       << compiler.codeCells().size() << " of " << image.size() << " cells, "
+       << compiler.patchedCount() << " patched operands, " << compiler.stopCount() << " interpreter fallbacks\n";
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <map>
+#include <set>
+#include <numeric>
+#include "IntcodeComputer.cpp"
+
+// Runs a workload of every Intcode day on each engine and prints the best
+// time out of a few runs, to pick the engine fitting a workload:
+//   g++ -std=c++17 -O2 -o intcode-bench intcode-bench.cpp && ./intcode-bench [runs]
+// Engines run interpreted, the last column is the default one with its native
+// code, JIT and loop tiers. Every engine must find the same result.
+
+template<typename VM> struct Engine { using type = VM; };
+
+void pushAscii(queue<IntCode> &inputs, const string &line) {
+  for(char c : line) {
+    inputs.push(c);
+  }
+  inputs.push('\n');
+}
+
+template<typename Workload>
+void bench(const string &day, Workload workload, int runs) {
+  const auto program = parseIntcode(getPuzzleInput("inputs/aoc_" + day + "_1.txt").front());
+  optional<IntCode> expected {};
+  const auto time = [&](auto engine, bool tiered) {
+    const IntcodeTierSettings tiers = intcodeTiers;
+    if(!tiered) {
+      intcodeTiers = {false, 0, 0, false};
+    }
+    double best = numeric_limits<double>::max();
+    for(int run = 0; run < runs; run++) {
+      const auto start = chrono::steady_clock::now();
+      const IntCode result = workload(engine, program);
+      best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+      if(expected && *expected != result) {
+        cerr << day << ": engines disagree, " << result << " instead of " << *expected << "\n";
+        throw;
+      }
+      expected = result;
+    }
+    intcodeTiers = tiers;
+    cout << setw(12) << fixed << setprecision(3) << best;
+  };
+  cout << setw(6) << day.substr(3);
+  time(Engine<CheckedIntcodeVM>(), false);
+  time(Engine<IntcodeVM>(), false);
+  time(Engine<UncheckedIntcodeVM>(), false);
+  time(Engine<NarrowIntcodeVM>(), false);
+  time(Engine<IntcodeVM>(), true);
+  cout << "   " << *expected << "\n";
+}
+
+int main(int argc, char const *argv[])
+{
+  const int runs = argc > 1 ? stoi(argv[1]) : 5;
+  cout << "best of " << runs << " runs, in ms\n"
+       << "   day     checked     address   unchecked    32 cells      tiered   result\n";
+
+  // Noun and verb search
+  bench("day2", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    for(IntCode noun = 0; noun < 100; noun++) {
+      for(IntCode verb = 0; verb < 100; verb++) {
+        VM vm(program);
+        vm.write(1, noun);
+        vm.write(2, verb);
+        if(vm.resume().read(0) == 19690720) {
+          return 100 * noun + verb;
+        }
+      }
+    }
+    return IntCode(-1);
+  }, runs);
+
+  bench("day5", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    return VM(program, queue<IntCode>({1})).resume().outputs.back() + VM(program, queue<IntCode>({5})).resume().outputs.back();
+  }, runs);
+
+  // Feedback loops of every phase permutation
+  bench("day7", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    array<IntCode, 5> phases {5, 6, 7, 8, 9};
+    IntCode best = 0;
+    do {
+      vector<VM> amplifiers;
+      for(const IntCode phase : phases) {
+        amplifiers.emplace_back(program, queue<IntCode>({phase}));
+      }
+      IntCode signal = 0;
+      while(!amplifiers.back().terminated) {
+        for(VM &amplifier : amplifiers) {
+          amplifier.inputs.push(signal);
+          signal = amplifier.resume().outputs.back();
+          amplifier.outputs.clear();
+        }
+      }
+      best = max(best, signal);
+    } while(next_permutation(phases.begin(), phases.end()));
+    return best;
+  }, runs);
+
+  bench("day9", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    return VM(program, queue<IntCode>({1})).resume().outputs.back() + VM(program, queue<IntCode>({2})).resume().outputs.back();
+  }, runs);
+
+  // Painted panels, starting on a white one
+  bench("day11", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    VM robot(program);
+    robot.pauseAfterOutputs(2);
+    map<pair<int, int>, IntCode> panels {{{0, 0}, 1}};
+    pair<int, int> position {0, 0};
+    pair<int, int> direction {0, -1};
+    while(true) {
+      robot.inputs.push(panels[position]);
+      if(robot.resume().terminated) {
+        return IntCode(panels.size());
+      }
+      panels[position] = robot.outputs[0];
+      direction = robot.outputs[1] ? make_pair(-direction.second, direction.first) : make_pair(direction.second, -direction.first);
+      position = {position.first + direction.first, position.second + direction.second};
+      robot.outputs.clear();
+    }
+  }, runs);
+
+  // The whole game, the paddle following the ball
+  bench("day13", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    VM game(program);
+    game.write(0, 2);
+    IntCode ball = 0, paddle = 0, score = 0;
+    while(true) {
+      game.resume();
+      for(size_t i = 0; i + 2 < game.outputs.size(); i += 3) {
+        const IntCode x = game.outputs[i], tile = game.outputs[i + 2];
+        if(x == -1) score = tile;
+        else if(tile == 3) paddle = x;
+        else if(tile == 4) ball = x;
+      }
+      game.outputs.clear();
+      if(game.terminated) {
+        return score;
+      }
+      game.inputs.push(ball < paddle ? -1 : ball > paddle ? 1 : 0);
+    }
+  }, runs);
+
+  // Breadth first search of the oxygen system, a droid forked per move
+  bench("day15", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    const array<pair<int, int>, 4> moves {{{0, -1}, {0, 1}, {-1, 0}, {1, 0}}};
+    set<pair<int, int>> visited {{0, 0}};
+    vector<pair<VM, pair<int, int>>> frontier {{VM(program), {0, 0}}};
+    for(IntCode distance = 1; !frontier.empty(); distance++) {
+      vector<pair<VM, pair<int, int>>> next;
+      for(const auto &[droid, position] : frontier) {
+        for(size_t direction = 0; direction < moves.size(); direction++) {
+          const pair<int, int> to {position.first + moves[direction].first, position.second + moves[direction].second};
+          if(!visited.insert(to).second) {
+            continue;
+          }
+          VM moved = droid.fork();
+          moved.inputs.push(direction + 1);
+          const IntCode status = moved.resume().outputs.back();
+          if(status == 2) {
+            return distance;
+          }
+          if(status == 1) {
+            moved.outputs.clear();
+            next.push_back({move(moved), to});
+          }
+        }
+      }
+      frontier = move(next);
+    }
+    return IntCode(-1);
+  }, runs);
+
+  bench("day17", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    const auto view = VM(program).resume().outputs;
+    return accumulate(view.cbegin(), view.cend(), IntCode(0));
+  }, runs);
+
+  // Points of the 50x50 area pulled by the beam
+  bench("day19", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    const auto drone = VM(program).snapshot();
+    IntCode pulled = 0;
+    for(IntCode y = 0; y < 50; y++) {
+      for(IntCode x = 0; x < 50; x++) {
+        VM probe = drone.fork();
+        probe.inputs.push(x);
+        probe.inputs.push(y);
+        pulled += probe.resume().outputs.back();
+      }
+    }
+    return pulled;
+  }, runs);
+
+  bench("day21", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    VM droid(program);
+    for(const string line : {"NOT A T", "NOT B J", "OR T J", "NOT C T", "OR T J", "AND D J", "NOT H T", "NOT T T", "OR E T", "AND T J", "RUN"}) {
+      pushAscii(droid.inputs, line);
+    }
+    return droid.resume().outputs.back();
+  }, runs);
+
+  // First packet sent to address 255
+  bench("day23", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    vector<VM> nics;
+    for(IntCode address = 0; address < 50; address++) {
+      nics.emplace_back(program, queue<IntCode>({address}));
+    }
+    while(true) {
+      for(VM &nic : nics) {
+        if(nic.inputs.empty()) {
+          nic.inputs.push(-1);
+        }
+        nic.resume();
+        for(size_t i = 0; i + 2 < nic.outputs.size(); i += 3) {
+          if(nic.outputs[i] == 255) {
+            return nic.outputs[i + 2];
+          }
+          nics[nic.outputs[i]].inputs.push(nic.outputs[i + 1]);
+          nics[nic.outputs[i]].inputs.push(nic.outputs[i + 2]);
+        }
+        nic.outputs.clear();
+      }
+    }
+  }, runs);
+
+  // A few rooms of the ship
+  bench("day25", [](auto engine, const vector<IntCode> &program) {
+    using VM = typename decltype(engine)::type;
+    VM droid(program);
+    for(const string line : {"west", "take mug", "north", "south", "east", "east", "take coin", "north", "north", "take hypercube"}) {
+      pushAscii(droid.inputs, line);
+    }
+    return IntCode(droid.resume().outputs.size());
+  }, runs);
+
+  return 0;
+}
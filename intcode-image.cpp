@@ -0,0 +1,32 @@
+#include <iostream>
+#include <chrono>
+#include "IntcodeImage.cpp"
+
+// Compiles the text form of an Intcode program to a binary image:
+//   intcode-image inputs/aoc_day25_1.txt day25.intcode
+// Drivers load either form with loadIntcodeMemory.
+int main(int argc, char const *argv[])
+{
+  testIntcodeImage();
+
+  if(argc < 3) {
+    cerr << "Usage: " << argv[0] << " <program.txt> <program.intcode>\n";
+    return 1;
+  }
+
+  const auto parseStart = chrono::steady_clock::now();
+  const auto program = parseIntcode(getPuzzleInput(argv[1]).front());
+  const auto parseEnd = chrono::steady_clock::now();
+  writeIntcodeImage(program, argv[2]);
+
+  const auto mapStart = chrono::steady_clock::now();
+  const auto image = mapIntcodeImage(argv[2]);
+  const auto mapEnd = chrono::steady_clock::now();
+  assert(verifyIntcodeImage(image) && image.memory.toVector() == program);
+
+  const auto micros = [](auto d) { return chrono::duration_cast<chrono::microseconds>(d).count(); };
+  cout << argv[2] << ": " << image.cellCount << " cells, hash " << hex << image.hash << dec << "\n";
+  cout << "Text parsed in " << micros(parseEnd - parseStart) << "us, image mapped in " << micros(mapEnd - mapStart) << "us\n";
+
+  return 0;
+}
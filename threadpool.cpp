@@ -0,0 +1,215 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include "utils.cpp"
+
+// Work-stealing thread pool: every worker owns a deque, it pops its own tasks
+// from the back and steals from the front of the others when it runs dry.
+// Tasks submitted from a worker land in that worker's deque.
+// Needs -pthread.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(size_t threadCount = thread::hardware_concurrency()) {
+    threadCount = max<size_t>(threadCount, 1);
+    for(size_t i = 0; i < threadCount; i++) {
+      queues.push_back(make_unique<WorkerQueue>());
+    }
+    for(size_t i = 0; i < threadCount; i++) {
+      workers.emplace_back([this, i]() { work(i); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> lock(sleepLock);
+      stopping = true;
+    }
+    wakeUp.notify_all();
+    for(auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  size_t size() const { return workers.size(); }
+
+  void submit(function<void()> task) {
+    const size_t target = currentPool == this ? currentWorker : nextQueue++ % queues.size();
+    pending++;
+    {
+      lock_guard<mutex> lock(queues[target]->lock);
+      queues[target]->tasks.push_back(move(task));
+    }
+    {
+      lock_guard<mutex> lock(sleepLock);
+      queued++;
+    }
+    wakeUp.notify_one();
+  }
+
+  // Blocks until every submitted task, including the ones submitted by tasks, is done.
+  // Must not be called from a worker.
+  void wait() {
+    unique_lock<mutex> lock(sleepLock);
+    idle.wait(lock, [&]() { return pending == 0; });
+  }
+
+private:
+  struct WorkerQueue
+  {
+    mutex lock;
+    deque<function<void()>> tasks;
+  };
+
+  vector<unique_ptr<WorkerQueue>> queues;
+  vector<thread> workers;
+  atomic<size_t> nextQueue {0};
+  atomic<size_t> pending {0};
+  size_t queued = 0;
+  bool stopping = false;
+  mutex sleepLock;
+  condition_variable wakeUp;
+  condition_variable idle;
+
+  inline static thread_local ThreadPool *currentPool = nullptr;
+  inline static thread_local size_t currentWorker = 0;
+
+  bool pop(size_t worker, function<void()> &task) {
+    for(size_t i = 0; i < queues.size(); i++) {
+      const size_t victim = (worker + i) % queues.size();
+      lock_guard<mutex> lock(queues[victim]->lock);
+      auto &tasks = queues[victim]->tasks;
+      if(tasks.empty()) {
+        continue;
+      }
+      if(victim == worker) {
+        task = move(tasks.back());
+        tasks.pop_back();
+      } else {
+        task = move(tasks.front());
+        tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void work(size_t worker) {
+    currentPool = this;
+    currentWorker = worker;
+    while(true) {
+      {
+        unique_lock<mutex> lock(sleepLock);
+        wakeUp.wait(lock, [&]() { return stopping || queued > 0; });
+        if(queued == 0) {
+          return;
+        }
+        queued--;
+      }
+      function<void()> task;
+      // A task is queued for every decrement, if another worker took ours we take theirs
+      while(!pop(worker, task));
+      task();
+      if(--pending == 0) {
+        lock_guard<mutex> lock(sleepLock);
+        idle.notify_all();
+      }
+    }
+  }
+};
+
+// Calls f(begin, end) on chunks of [0, count) spread over the pool
+template<typename F>
+void parallelChunks(ThreadPool &pool, size_t count, F f) {
+  const size_t chunk = max<size_t>(1, count / (pool.size() * 8));
+  for(size_t begin = 0; begin < count; begin += chunk) {
+    const size_t end = min(count, begin + chunk);
+    pool.submit([=, &f]() { f(begin, end); });
+  }
+  pool.wait();
+}
+
+// Smallest index in [0, count) matching the predicate, the same one a serial
+// scan returns. Chunks stop as soon as a smaller match is known.
+template<typename Predicate>
+optional<size_t> parallelFindFirst(ThreadPool &pool, size_t count, Predicate matches) {
+  atomic<size_t> firstMatch {count};
+  parallelChunks(pool, count, [&](size_t begin, size_t end) {
+    for(size_t i = begin; i < end && i < firstMatch; i++) {
+      if(matches(i)) {
+        size_t known = firstMatch;
+        while(i < known && !firstMatch.compare_exchange_weak(known, i));
+        return;
+      }
+    }
+  });
+  return firstMatch < count ? optional<size_t>(firstMatch) : nullopt;
+}
+
+// Folds map(i) for every i in [0, count) with combine, which must be associative and commutative
+template<typename T, typename Map, typename Combine>
+T parallelReduce(ThreadPool &pool, size_t count, T init, Map map, Combine combine) {
+  mutex resultLock;
+  T result = init;
+  parallelChunks(pool, count, [&](size_t begin, size_t end) {
+    T partial = init;
+    for(size_t i = begin; i < end; i++) {
+      partial = combine(partial, map(i));
+    }
+    lock_guard<mutex> lock(resultLock);
+    result = combine(result, partial);
+  });
+  return result;
+}
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side caches the other's index so that it only reads
+// the shared atomic when the ring looks full or empty.
+template<typename T, size_t Capacity>
+class SpscRing
+{
+  static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+  // False when the ring is full
+  bool push(const T &value) {
+    const size_t tail = writeIndex.load(memory_order_relaxed);
+    if(tail - cachedReadIndex == Capacity) {
+      cachedReadIndex = readIndex.load(memory_order_acquire);
+      if(tail - cachedReadIndex == Capacity) {
+        return false;
+      }
+    }
+    slots[tail & (Capacity - 1)] = value;
+    writeIndex.store(tail + 1, memory_order_release);
+    return true;
+  }
+
+  // False when the ring is empty
+  bool pop(T &value) {
+    const size_t head = readIndex.load(memory_order_relaxed);
+    if(head == cachedWriteIndex) {
+      cachedWriteIndex = writeIndex.load(memory_order_acquire);
+      if(head == cachedWriteIndex) {
+        return false;
+      }
+    }
+    value = slots[head & (Capacity - 1)];
+    readIndex.store(head + 1, memory_order_release);
+    return true;
+  }
+
+private:
+  alignas(64) atomic<size_t> writeIndex {0};
+  size_t cachedReadIndex = 0; // producer side
+  alignas(64) atomic<size_t> readIndex {0};
+  size_t cachedWriteIndex = 0; // consumer side
+  alignas(64) array<T, Capacity> slots {};
+};
@@ -1,3 +1,4 @@
+#pragma once
 #include <fstream>
 #include <unordered_map>
 #include <unordered_set>
@@ -71,15 +72,14 @@ tuple<string, string> cut(const string &s, const string delimiter) {
 }
 
 vector<string> split(const string &s, const string delimiter) {
+  size_t tokenStart = 0;
   size_t delimiterIndex = 0;
-  string str = s;
   vector<string> tokens;
-  while ((delimiterIndex = str.find(delimiter)) != string::npos) {
-    const string token = str.substr(0, delimiterIndex);
-    tokens.push_back(token);
-    str = str.substr(delimiterIndex + delimiter.length());
+  while ((delimiterIndex = s.find(delimiter, tokenStart)) != string::npos) {
+    tokens.push_back(s.substr(tokenStart, delimiterIndex - tokenStart));
+    tokenStart = delimiterIndex + delimiter.length();
   }
-  tokens.push_back(str);
+  tokens.push_back(s.substr(tokenStart));
   return tokens;
 }
 